@@ -0,0 +1,623 @@
+/*
+ * This file is part of libsmack
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+
+#include "sys/smack.h"
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/* io_uring got the xattr operations in Linux 5.19, together with 128 byte
+ * submission entries */
+#if defined(IORING_SETUP_SQE128) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
+#define SELF_FD_PATH "/proc/self/fd/%d/%s"
+#define BATCH_DEPTH_MAX 4096
+#define BATCH_THREADS_MAX 64
+
+enum batch_type {
+	BATCH_GET,
+	BATCH_SET,
+	BATCH_REMOVE
+};
+
+struct batch_op {
+	enum batch_type type;
+	int dirfd;
+	const char *path;
+	const char *xattr;
+	int flags;
+	char *value;
+	size_t len;
+	char *ring_path;
+	smack_batch_fn fn;
+	void *data;
+	ssize_t result;
+	int error;
+	int next;
+};
+
+struct smack_label_batch {
+	struct batch_op *ops;
+	int depth;
+	int free_op;
+	int inflight;
+
+	/* io_uring, ring_fd is negative when it is not used */
+	int ring_fd;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *sqes;
+	size_t sqes_size;
+	struct io_uring_cqe *cqes;
+	unsigned to_submit;
+	int ring_inflight;
+
+	/* thread pool for the operations io_uring can't do */
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int threads_cnt;
+	int threads_max;
+	int *queue;
+	int queue_head;
+	int queue_cnt;
+	int done;
+	int pool_inflight;
+	int stop;
+};
+
+#ifdef HAVE_IO_URING
+static int ring_setup(struct smack_label_batch *batch)
+{
+	struct {
+		struct io_uring_probe probe;
+		struct io_uring_probe_op ops[IORING_OP_LAST];
+	} probe;
+	struct io_uring_params p;
+	int single;
+
+	memset(&p, 0, sizeof(p));
+	batch->ring_fd = syscall(__NR_io_uring_setup, batch->depth, &p);
+	if (batch->ring_fd < 0)
+		return -1;
+
+	memset(&probe, 0, sizeof(probe));
+	if (syscall(__NR_io_uring_register, batch->ring_fd,
+		    IORING_REGISTER_PROBE, &probe, IORING_OP_LAST) < 0 ||
+	    probe.probe.last_op < IORING_OP_SETXATTR ||
+	    probe.probe.last_op < IORING_OP_GETXATTR ||
+	    !(probe.ops[IORING_OP_GETXATTR].flags & IO_URING_OP_SUPPORTED) ||
+	    !(probe.ops[IORING_OP_SETXATTR].flags & IO_URING_OP_SUPPORTED))
+		goto err_out;
+
+	single = p.features & IORING_FEAT_SINGLE_MMAP;
+	batch->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	batch->cq_size = p.cq_off.cqes +
+			 p.cq_entries * sizeof(struct io_uring_cqe);
+	if (single && batch->cq_size > batch->sq_size)
+		batch->sq_size = batch->cq_size;
+
+	batch->sq_ptr = mmap(NULL, batch->sq_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, batch->ring_fd,
+			     IORING_OFF_SQ_RING);
+	if (batch->sq_ptr == MAP_FAILED)
+		goto err_out;
+
+	if (single) {
+		batch->cq_ptr = batch->sq_ptr;
+	} else {
+		batch->cq_ptr = mmap(NULL, batch->cq_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE,
+				     batch->ring_fd, IORING_OFF_CQ_RING);
+		if (batch->cq_ptr == MAP_FAILED)
+			goto err_sq;
+	}
+
+	batch->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	batch->sqes = mmap(NULL, batch->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, batch->ring_fd,
+			   IORING_OFF_SQES);
+	if (batch->sqes == MAP_FAILED)
+		goto err_cq;
+
+	batch->sq_tail = (unsigned *)((char *)batch->sq_ptr + p.sq_off.tail);
+	batch->sq_mask = (unsigned *)((char *)batch->sq_ptr +
+				      p.sq_off.ring_mask);
+	batch->sq_array = (unsigned *)((char *)batch->sq_ptr +
+				       p.sq_off.array);
+	batch->cq_head = (unsigned *)((char *)batch->cq_ptr + p.cq_off.head);
+	batch->cq_tail = (unsigned *)((char *)batch->cq_ptr + p.cq_off.tail);
+	batch->cq_mask = (unsigned *)((char *)batch->cq_ptr +
+				      p.cq_off.ring_mask);
+	batch->cqes = (struct io_uring_cqe *)((char *)batch->cq_ptr +
+					      p.cq_off.cqes);
+	return 0;
+
+err_cq:
+	if (batch->cq_ptr != batch->sq_ptr)
+		munmap(batch->cq_ptr, batch->cq_size);
+err_sq:
+	munmap(batch->sq_ptr, batch->sq_size);
+err_out:
+	close(batch->ring_fd);
+	batch->ring_fd = -1;
+	return -1;
+}
+
+static void ring_free(struct smack_label_batch *batch)
+{
+	if (batch->ring_fd < 0)
+		return;
+	munmap(batch->sqes, batch->sqes_size);
+	if (batch->cq_ptr != batch->sq_ptr)
+		munmap(batch->cq_ptr, batch->cq_size);
+	munmap(batch->sq_ptr, batch->sq_size);
+	close(batch->ring_fd);
+}
+
+/* io_uring resolves paths of xattr operations from the current directory
+ * and always follows symbolic links */
+static int ring_queue(struct smack_label_batch *batch, int i)
+{
+	struct batch_op *op = &batch->ops[i];
+	struct io_uring_sqe *sqe;
+	const char *path = op->path;
+	unsigned tail;
+	int len;
+
+	if (batch->ring_fd < 0 || op->type == BATCH_REMOVE ||
+	    (op->flags & (AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH)))
+		return -1;
+
+	if (path[0] != '/' && op->dirfd != AT_FDCWD) {
+		len = snprintf(NULL, 0, SELF_FD_PATH, op->dirfd, path);
+		op->ring_path = malloc(len + 1);
+		if (op->ring_path == NULL)
+			return -1;
+		snprintf(op->ring_path, len + 1, SELF_FD_PATH, op->dirfd, path);
+		path = op->ring_path;
+	}
+
+	tail = *batch->sq_tail;
+	sqe = (struct io_uring_sqe *)batch->sqes + (tail & *batch->sq_mask);
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = op->type == BATCH_GET ? IORING_OP_GETXATTR :
+					      IORING_OP_SETXATTR;
+	sqe->addr = (unsigned long)op->xattr;
+	sqe->addr2 = (unsigned long)op->value;
+	sqe->addr3 = (unsigned long)path;
+	sqe->len = op->len;
+	sqe->user_data = i;
+	batch->sq_array[tail & *batch->sq_mask] = tail & *batch->sq_mask;
+	__atomic_store_n(batch->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	batch->to_submit++;
+	batch->ring_inflight++;
+	return 0;
+}
+#else
+static int ring_setup(struct smack_label_batch *batch)
+{
+	batch->ring_fd = -1;
+	return -1;
+}
+
+static void ring_free(struct smack_label_batch *batch)
+{
+	(void)batch;
+}
+
+static int ring_queue(struct smack_label_batch *batch, int i)
+{
+	(void)batch;
+	(void)i;
+	return -1;
+}
+#endif
+
+static void batch_run(struct batch_op *op)
+{
+	switch (op->type) {
+	case BATCH_GET:
+		op->result = smack_get_label_from_path_at(op->dirfd, op->path,
+							  op->xattr, op->flags,
+							  op->value);
+		break;
+	case BATCH_SET:
+		op->result = smack_set_label_for_path_at(op->dirfd, op->path,
+							 op->xattr, op->flags,
+							 op->value);
+		break;
+	case BATCH_REMOVE:
+		op->result = smack_remove_label_for_path_at(op->dirfd,
+							    op->path,
+							    op->xattr,
+							    op->flags);
+		break;
+	}
+	op->error = op->result < 0 ? errno : 0;
+}
+
+static void *batch_worker(void *arg)
+{
+	struct smack_label_batch *batch = arg;
+	int i;
+
+	pthread_mutex_lock(&batch->lock);
+	for (;;) {
+		while (!batch->stop && !batch->queue_cnt)
+			pthread_cond_wait(&batch->work_cond, &batch->lock);
+		if (!batch->queue_cnt)
+			break;
+
+		i = batch->queue[batch->queue_head];
+		batch->queue_head = (batch->queue_head + 1) % batch->depth;
+		batch->queue_cnt--;
+		pthread_mutex_unlock(&batch->lock);
+
+		batch_run(&batch->ops[i]);
+
+		pthread_mutex_lock(&batch->lock);
+		batch->ops[i].next = batch->done;
+		batch->done = i;
+		pthread_cond_signal(&batch->done_cond);
+	}
+	pthread_mutex_unlock(&batch->lock);
+	return NULL;
+}
+
+static int pool_queue(struct smack_label_batch *batch, int i)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&batch->lock);
+	if (batch->threads_cnt < batch->threads_max &&
+	    batch->threads_cnt <= batch->pool_inflight) {
+		if (pthread_create(&batch->threads[batch->threads_cnt], NULL,
+				   batch_worker, batch) == 0)
+			batch->threads_cnt++;
+		else if (!batch->threads_cnt)
+			ret = -1;
+	}
+	if (ret == 0) {
+		batch->queue[(batch->queue_head + batch->queue_cnt) %
+			     batch->depth] = i;
+		batch->queue_cnt++;
+		batch->pool_inflight++;
+		pthread_cond_signal(&batch->work_cond);
+	}
+	pthread_mutex_unlock(&batch->lock);
+	return ret;
+}
+
+/* give the result of an operation to its callback and free the slot, the
+ * callback may queue new operations */
+static void batch_complete(struct smack_label_batch *batch, int i)
+{
+	struct batch_op *op = &batch->ops[i];
+	smack_batch_fn fn = op->fn;
+	void *data = op->data;
+	ssize_t result = op->result;
+	int error = op->error;
+
+	free(op->ring_path);
+	op->ring_path = NULL;
+	op->next = batch->free_op;
+	batch->free_op = i;
+	batch->inflight--;
+
+	if (fn) {
+		errno = error;
+		fn(result, data);
+	}
+}
+
+#ifdef HAVE_IO_URING
+static int ring_reap(struct smack_label_batch *batch, int wait)
+{
+	struct io_uring_cqe *cqe;
+	struct batch_op *op;
+	unsigned min = wait && batch->ring_inflight ? 1 : 0;
+	unsigned head;
+	int reaped = 0;
+	int ret;
+	int i;
+
+	if (batch->to_submit || min) {
+		ret = syscall(__NR_io_uring_enter, batch->ring_fd,
+			      batch->to_submit, min,
+			      min ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (ret < 0) {
+			if (errno != EINTR && errno != EAGAIN &&
+			    errno != EBUSY)
+				return -1;
+		} else {
+			batch->to_submit -= ret;
+		}
+	}
+
+	for (;;) {
+		head = *batch->cq_head;
+		if (head == __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE))
+			break;
+
+		cqe = &batch->cqes[head & *batch->cq_mask];
+		i = cqe->user_data;
+		op = &batch->ops[i];
+		if (cqe->res < 0) {
+			op->result = -1;
+			op->error = -cqe->res;
+		} else if (op->type == BATCH_GET) {
+			op->result = label_from_value(op->value, cqe->res);
+			op->error = op->result < 0 ? EINVAL : 0;
+		} else {
+			op->result = 0;
+			op->error = 0;
+		}
+		__atomic_store_n(batch->cq_head, head + 1, __ATOMIC_RELEASE);
+
+		batch->ring_inflight--;
+		batch_complete(batch, i);
+		reaped++;
+	}
+
+	return reaped;
+}
+#else
+static int ring_reap(struct smack_label_batch *batch, int wait)
+{
+	(void)batch;
+	(void)wait;
+	return 0;
+}
+#endif
+
+/* submit queued operations and complete the finished ones, if wait is
+ * set at least one operation is waited for */
+static int batch_reap(struct smack_label_batch *batch, int wait)
+{
+	int reaped = 0;
+	int next;
+	int i;
+
+	if (batch->to_submit || batch->ring_inflight) {
+		reaped = ring_reap(batch, wait);
+		if (reaped < 0)
+			return -1;
+	}
+
+	if (batch->pool_inflight) {
+		pthread_mutex_lock(&batch->lock);
+		while (wait && !reaped && !batch->ring_inflight &&
+		       batch->done < 0)
+			pthread_cond_wait(&batch->done_cond, &batch->lock);
+		i = batch->done;
+		batch->done = -1;
+		pthread_mutex_unlock(&batch->lock);
+
+		for (; i >= 0; i = next) {
+			next = batch->ops[i].next;
+			batch->pool_inflight--;
+			batch_complete(batch, i);
+			reaped++;
+		}
+	}
+
+	return reaped;
+}
+
+int smack_label_batch_new(struct smack_label_batch **batch, int depth,
+			  int flags)
+{
+	struct smack_label_batch *result;
+	long cpus;
+	int i;
+
+	if (depth <= 0 || depth > BATCH_DEPTH_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	result = calloc(1, sizeof(struct smack_label_batch));
+	if (result == NULL)
+		return -1;
+
+	result->depth = depth;
+	result->ops = calloc(depth, sizeof(struct batch_op));
+	result->queue = calloc(depth, sizeof(int));
+	if (result->ops == NULL || result->queue == NULL)
+		goto err_out;
+
+	for (i = 0; i < depth; i++)
+		result->ops[i].next = i + 1 < depth ? i + 1 : -1;
+	result->free_op = 0;
+	result->done = -1;
+
+	if (flags & SMACK_BATCH_THREADS)
+		result->ring_fd = -1;
+	else
+		ring_setup(result);
+
+	/* the pool does blocking system calls, use more threads than cpus */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	result->threads_max = cpus > 0 ? 4 * cpus : 4;
+	if (result->threads_max > BATCH_THREADS_MAX)
+		result->threads_max = BATCH_THREADS_MAX;
+	if (result->threads_max > depth)
+		result->threads_max = depth;
+	result->threads = calloc(result->threads_max, sizeof(pthread_t));
+	if (result->threads == NULL)
+		goto err_ring;
+
+	pthread_mutex_init(&result->lock, NULL);
+	pthread_cond_init(&result->work_cond, NULL);
+	pthread_cond_init(&result->done_cond, NULL);
+
+	*batch = result;
+	return 0;
+
+err_ring:
+	ring_free(result);
+err_out:
+	free(result->queue);
+	free(result->ops);
+	free(result);
+	return -1;
+}
+
+void smack_label_batch_free(struct smack_label_batch *batch)
+{
+	int i;
+
+	if (batch == NULL)
+		return;
+
+	smack_label_batch_flush(batch);
+
+	pthread_mutex_lock(&batch->lock);
+	batch->stop = 1;
+	pthread_cond_broadcast(&batch->work_cond);
+	pthread_mutex_unlock(&batch->lock);
+	for (i = 0; i < batch->threads_cnt; i++)
+		pthread_join(batch->threads[i], NULL);
+
+	pthread_cond_destroy(&batch->done_cond);
+	pthread_cond_destroy(&batch->work_cond);
+	pthread_mutex_destroy(&batch->lock);
+	ring_free(batch);
+	free(batch->threads);
+	free(batch->queue);
+	free(batch->ops);
+	free(batch);
+}
+
+int smack_label_batch_uses_io_uring(struct smack_label_batch *batch)
+{
+	return batch->ring_fd >= 0;
+}
+
+static int batch_add(struct smack_label_batch *batch, enum batch_type type,
+		     int dirfd, const char *path, const char *xattr,
+		     int flags, char *value, size_t len,
+		     smack_batch_fn fn, void *data)
+{
+	struct batch_op *op;
+	int i;
+
+	while (batch->free_op < 0)
+		if (batch_reap(batch, 1) < 0)
+			return -1;
+
+	i = batch->free_op;
+	op = &batch->ops[i];
+	batch->free_op = op->next;
+	batch->inflight++;
+
+	op->type = type;
+	op->dirfd = dirfd;
+	op->path = path;
+	op->xattr = xattr;
+	op->flags = flags;
+	op->value = value;
+	op->len = len;
+	op->ring_path = NULL;
+	op->fn = fn;
+	op->data = data;
+
+	if (ring_queue(batch, i) == 0) {
+		/* keep the kernel busy, submit every few operations */
+		if (batch->to_submit >= (unsigned)(batch->depth + 3) / 4 &&
+		    batch_reap(batch, 0) < 0)
+			return -1;
+		return 0;
+	}
+
+	if (pool_queue(batch, i) == 0)
+		return 0;
+
+	op->next = batch->free_op;
+	batch->free_op = i;
+	batch->inflight--;
+	return -1;
+}
+
+int smack_label_batch_get(struct smack_label_batch *batch, int dirfd,
+			  const char *path, const char *xattr, int flags,
+			  char *label, smack_batch_fn fn, void *data)
+{
+	return batch_add(batch, BATCH_GET, dirfd, path, xattr, flags,
+			 label, SMACK_LABEL_LEN + 1, fn, data);
+}
+
+int smack_label_batch_set(struct smack_label_batch *batch, int dirfd,
+			  const char *path, const char *xattr, int flags,
+			  const char *label, smack_batch_fn fn, void *data)
+{
+	ssize_t len;
+
+	len = smack_label_length(label);
+	if (len < 0)
+		return -2;
+
+	return batch_add(batch, BATCH_SET, dirfd, path, xattr, flags,
+			 (char *)label, len, fn, data);
+}
+
+int smack_label_batch_remove(struct smack_label_batch *batch, int dirfd,
+			     const char *path, const char *xattr, int flags,
+			     smack_batch_fn fn, void *data)
+{
+	return batch_add(batch, BATCH_REMOVE, dirfd, path, xattr, flags,
+			 NULL, 0, fn, data);
+}
+
+int smack_label_batch_flush(struct smack_label_batch *batch)
+{
+	while (batch->inflight)
+		if (batch_reap(batch, 1) < 0)
+			return -1;
+	return 0;
+}
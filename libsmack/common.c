@@ -152,6 +152,11 @@ static int apply_path(const char *path, void *smack, add_func func)
 	return ret;
 }
 
+int load_rules(const char *path, struct smack_accesses *rules)
+{
+	return apply_path(path, rules, (add_func) smack_accesses_add_from_file);
+}
+
 int apply_rules(const char *path, int clear)
 {
 	struct smack_accesses *rules = NULL;
@@ -162,7 +167,7 @@ int apply_rules(const char *path, int clear)
 		return -1;
 	}
 
-	ret = apply_path(path, rules, (add_func) smack_accesses_add_from_file);
+	ret = load_rules(path, rules);
 	if (ret) {
 		smack_accesses_free(rules);
 		return ret;
@@ -182,7 +187,7 @@ int apply_rules(const char *path, int clear)
 	return 0;
 }
 
-int apply_cipso(const char *path)
+int apply_cipso(const char *path, int *changed, int *unchanged)
 {
 	struct smack_cipso *cipso = NULL;
 	int ret;
@@ -199,7 +204,7 @@ int apply_cipso(const char *path)
 		return ret;
 	}
 
-	ret = smack_cipso_apply(cipso);
+	ret = smack_cipso_apply_changes(cipso, changed, unchanged);
 	smack_cipso_free(cipso);
 	if (ret) {
 		fputs("Applying CIPSO failed.\n", stderr);
@@ -208,3 +213,20 @@ int apply_cipso(const char *path)
 
 	return 0;
 }
+
+/* Terminate and validate a label value of 'len' bytes read into a buffer
+ * of SMACK_LABEL_LEN + 1 characters. Values may carry a terminating null
+ * character, which is why one more byte than the longest label is read. */
+ssize_t label_from_value(char *label, ssize_t len)
+{
+	if (len < 0)
+		return -1;
+
+	if (len > SMACK_LABEL_LEN) {
+		if (label[SMACK_LABEL_LEN] != '\0')
+			return -1;
+	} else
+		label[len] = '\0';
+
+	return smack_label_length(label);
+}
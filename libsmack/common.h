@@ -21,12 +21,18 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <sys/types.h>
+
 #define ACCESSES_D_PATH "/etc/smack/accesses.d"
 #define CIPSO_D_PATH "/etc/smack/cipso.d"
 #define ONLYCAP_PATH "/etc/smack/onlycap"
 
+struct smack_accesses;
+
 int clear(void);
+int load_rules(const char *path, struct smack_accesses *rules);
 int apply_rules(const char *path, int clear);
-int apply_cipso(const char *path);
+int apply_cipso(const char *path, int *changed, int *unchanged);
+ssize_t label_from_value(char *label, ssize_t len);
 
 #endif // COMMON_H
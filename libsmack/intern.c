@@ -0,0 +1,237 @@
+/*
+ * This file is part of libsmack
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "sys/smack.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_TABLE_SIZE 256
+#define INTERN_CHUNK_SHIFT 8
+#define INTERN_CHUNKS 23
+
+/* Labels are interned once per process and never released, only labels
+ * passed to the public functions below get here. Lookups run without
+ * locks: slots of a table only ever go from empty to an entry, and a
+ * table is replaced by a fully populated bigger one. Replaced tables are
+ * kept because readers may still be probing them. Inserts are serialized
+ * by a mutex. */
+struct intern_entry {
+	uint32_t hash;
+	smack_intern_id id;
+	char label[];
+};
+
+struct intern_table {
+	uint32_t mask;
+	struct intern_table *retired;
+	struct intern_entry *slots[];
+};
+
+static struct intern_table *intern_current;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Ids index a directory of chunks, chunk k holds 2^k * 256 entries. The
+ * chunks never move, so an id is resolved without a lock too. */
+static struct intern_entry **intern_chunks[INTERN_CHUNKS];
+static int intern_cnt;
+
+static inline void id_position(smack_intern_id id, int *chunk, int *offset)
+{
+	unsigned int n = ((unsigned int)id >> INTERN_CHUNK_SHIFT) + 1;
+	int k = 31 - __builtin_clz(n);
+
+	*chunk = k;
+	*offset = id - (((1 << k) - 1) << INTERN_CHUNK_SHIFT);
+}
+
+static struct intern_table *table_new(uint32_t size)
+{
+	struct intern_table *table;
+
+	table = calloc(1, sizeof(struct intern_table) +
+		       size * sizeof(struct intern_entry *));
+	if (table == NULL)
+		return NULL;
+	table->mask = size - 1;
+	return table;
+}
+
+static struct intern_entry *table_find(struct intern_table *table,
+				       const char *label, int len,
+				       uint32_t hash)
+{
+	struct intern_entry *entry;
+	uint32_t i;
+
+	for (i = hash & table->mask;; i = (i + 1) & table->mask) {
+		entry = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+		if (entry == NULL)
+			return NULL;
+		if (entry->hash == hash && !memcmp(entry->label, label, len) &&
+		    entry->label[len] == '\0')
+			return entry;
+	}
+}
+
+static void table_put(struct intern_table *table, struct intern_entry *entry)
+{
+	uint32_t i;
+
+	for (i = entry->hash & table->mask; table->slots[i] != NULL;
+	     i = (i + 1) & table->mask)
+		;
+	__atomic_store_n(&table->slots[i], entry, __ATOMIC_RELEASE);
+}
+
+static int table_grow(void)
+{
+	struct intern_table *table;
+	uint32_t size;
+	uint32_t i;
+
+	size = intern_current ? (intern_current->mask + 1) << 1 :
+				INTERN_TABLE_SIZE;
+	table = table_new(size);
+	if (table == NULL)
+		return -1;
+
+	if (intern_current != NULL) {
+		for (i = 0; i <= intern_current->mask; ++i)
+			if (intern_current->slots[i] != NULL)
+				table_put(table, intern_current->slots[i]);
+		table->retired = intern_current;
+	}
+
+	__atomic_store_n(&intern_current, table, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static struct intern_entry *intern_insert(const char *label, int len,
+					  uint32_t hash)
+{
+	struct intern_entry *entry;
+	struct intern_entry **chunk;
+	int k;
+	int offset;
+
+	pthread_mutex_lock(&intern_lock);
+
+	if (intern_current != NULL) {
+		entry = table_find(intern_current, label, len, hash);
+		if (entry != NULL)
+			goto out;
+	}
+
+	entry = NULL;
+	id_position(intern_cnt, &k, &offset);
+	if (k >= INTERN_CHUNKS)
+		goto out;
+
+	if (intern_current == NULL ||
+	    2 * (uint32_t)(intern_cnt + 1) > intern_current->mask + 1)
+		if (table_grow())
+			goto out;
+
+	chunk = intern_chunks[k];
+	if (chunk == NULL) {
+		chunk = calloc((size_t)1 << (k + INTERN_CHUNK_SHIFT),
+			       sizeof(struct intern_entry *));
+		if (chunk == NULL)
+			goto out;
+		__atomic_store_n(&intern_chunks[k], chunk, __ATOMIC_RELEASE);
+	}
+
+	entry = malloc(sizeof(struct intern_entry) + len + 1);
+	if (entry == NULL)
+		goto out;
+	entry->hash = hash;
+	entry->id = intern_cnt;
+	memcpy(entry->label, label, len);
+	entry->label[len] = '\0';
+
+	__atomic_store_n(&chunk[offset], entry, __ATOMIC_RELEASE);
+	table_put(intern_current, entry);
+	__atomic_store_n(&intern_cnt, intern_cnt + 1, __ATOMIC_RELEASE);
+
+out:
+	pthread_mutex_unlock(&intern_lock);
+	return entry;
+}
+
+static struct intern_entry *intern(const char *label, int len, uint32_t hash)
+{
+	struct intern_table *table;
+	struct intern_entry *entry;
+
+	table = __atomic_load_n(&intern_current, __ATOMIC_ACQUIRE);
+	if (table != NULL) {
+		entry = table_find(table, label, len, hash);
+		if (entry != NULL)
+			return entry;
+	}
+
+	return intern_insert(label, len, hash);
+}
+
+static struct intern_entry *intern_string(const char *label)
+{
+	uint32_t hash = 5381;
+	ssize_t len;
+	int i;
+
+	len = smack_label_length(label);
+	if (len < 0)
+		return NULL;
+
+	for (i = 0; i < len; ++i)
+		hash = (hash << 5) + hash + label[i];
+
+	return intern(label, len, hash);
+}
+
+const char *smack_intern_label(const char *label)
+{
+	struct intern_entry *entry = intern_string(label);
+
+	return entry ? entry->label : NULL;
+}
+
+smack_intern_id smack_intern_label_id(const char *label)
+{
+	struct intern_entry *entry = intern_string(label);
+
+	return entry ? entry->id : -1;
+}
+
+const char *smack_interned_label(smack_intern_id id)
+{
+	struct intern_entry **chunk;
+	struct intern_entry *entry;
+	int k;
+	int offset;
+
+	if (id < 0 || id >= __atomic_load_n(&intern_cnt, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	id_position(id, &k, &offset);
+	chunk = __atomic_load_n(&intern_chunks[k], __ATOMIC_ACQUIRE);
+	entry = __atomic_load_n(&chunk[offset], __ATOMIC_ACQUIRE);
+	return entry->label;
+}
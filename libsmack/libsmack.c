@@ -20,22 +20,34 @@
  * 02110-1301 USA
  */
 
+#define _GNU_SOURCE
+
 #include "sys/smack.h"
 #include "common.h"
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/xattr.h>
+#include <linux/xattr.h>
+#include <sched.h>
+#include <pthread.h>
 
 #define SELF_LABEL_FILE "/proc/self/attr/current"
+#define THREAD_LABEL_FILE "/proc/thread-self/attr/current"
+#define SELF_FD_PATH "/proc/self/fd/%d/%s"
+#define SELF_FD_PATH_LEN (sizeof(SELF_FD_PATH) + 10 + PATH_MAX)
 #define PID_LABEL_FILE "/proc/%d/attr/current"
+#define XATTR_LIST_LEN 1024
 
 #define SHORT_LABEL_LEN 23
 #define ACC_LEN 6
@@ -68,6 +80,10 @@
 #define ACCESS_TYPE_ALL ((1 << ACC_LEN) - 1)
 
 #define DICT_HASH_SIZE 4096
+#define LABEL_CHUNK_SIZE 4096
+
+#define READER_SLOTS 128
+#define CACHE_LINE_SIZE 64
 
 extern char *smackfs_mnt;
 extern int smackfs_mnt_dirfd;
@@ -84,14 +100,14 @@ union smack_perm {
 
 struct smack_rule {
 	union smack_perm perm;
-	int object_id;
+	smack_label_id object_id;
 	struct smack_rule *next_rule;
 };
 
 struct smack_label {
 	uint8_t len;
-	int id;
-	char *label;
+	smack_label_id id;
+	const char *label;
 	struct smack_rule *first_rule;
 	struct smack_rule *last_rule;
 	struct smack_label *next_label;
@@ -102,6 +118,13 @@ struct smack_hash_entry {
 	struct smack_label *last;
 };
 
+/* Labels of a handle are copied into chunks owned by the handle. */
+struct label_chunk {
+	struct label_chunk *next;
+	size_t used;
+	char data[LABEL_CHUNK_SIZE];
+};
+
 struct smack_accesses {
 	int has_long;
 	int labels_cnt;
@@ -109,22 +132,93 @@ struct smack_accesses {
 	int page_size;
 	struct smack_label **labels;
 	struct smack_hash_entry *label_hash;
+	struct label_chunk *label_chunks;
 	union smack_perm *merge_perms;
 	int *merge_object_ids;
 };
 
+struct smack_decision {
+	smack_label_id subject_id;
+	smack_label_id object_id;
+	int code;
+};
+
+struct smack_rule_group {
+	int code;
+	uint32_t start;
+};
+
+/* Rules of a policy grouped by one of their labels and then by access
+ * code. Groups of label 'id' are groups[offsets[id]] to
+ * groups[offsets[id + 1] - 1], labels on the other side of the rules of a
+ * group are ids[group.start] to ids[next_group.start - 1]. */
+struct smack_rule_index {
+	uint32_t *offsets;
+	struct smack_rule_group *groups;
+	smack_label_id *ids;
+};
+
+struct smack_policy {
+	int labels_cnt;
+	char **labels;
+	char *label_data;
+	smack_label_id *label_table;
+	uint32_t label_mask;
+	struct smack_decision *decisions;
+	uint32_t decision_mask;
+	uint32_t decisions_cnt;
+	struct smack_rule_index by_subject;
+	struct smack_rule_index by_object;
+};
+
+/* Readers are counted per slot and per phase, slots are padded to separate
+ * cache lines so that readers on different CPUs do not contend. */
+struct smack_reader_slot {
+	unsigned long count[2];
+} __attribute__ ((aligned(CACHE_LINE_SIZE)));
+
+struct smack_shared_policy {
+	struct smack_policy *current;
+	int phase;
+	pthread_mutex_t writer_lock;
+	struct smack_reader_slot slots[READER_SLOTS];
+};
+
 struct cipso_mapping {
-	char label[SMACK_LABEL_LEN + 1];
+	const char *label;
+	unsigned int hash;
 	uint8_t cats[BITNSLOTS(CAT_MAX_COUNT)];
-	int ncats;
-	int level;
-	struct cipso_mapping *next;
+	uint8_t ncats;
+	uint8_t level;
 };
 
 struct smack_cipso {
 	int has_long;
-	struct cipso_mapping *first;
-	struct cipso_mapping *last;
+	/* one mapping per label, in order of first definition */
+	struct cipso_mapping *mappings;
+	int mappings_cnt;
+	int mappings_alloc;
+	/* open addressing table of mapping index + 1, 0 for an empty slot */
+	int *index;
+	unsigned int index_mask;
+	struct label_chunk *label_chunks;
+};
+
+struct smack_cipso_index {
+	struct cipso_mapping *mappings;
+	int mappings_cnt;
+	/* open addressing tables of mapping index + 1, 0 for an empty slot */
+	int *by_label;
+	int *by_tuple;
+	unsigned int mask;
+	struct label_chunk *label_chunks;
+};
+
+enum xattr_op {
+	XATTR_OP_GET,
+	XATTR_OP_SET,
+	XATTR_OP_REMOVE,
+	XATTR_OP_LIST
 };
 
 struct smack_file_buffer {
@@ -138,6 +232,8 @@ struct smack_file_buffer {
 static int open_smackfs_file(const char *long_name, const char *short_name,
 			     mode_t mode, int *use_long);
 static int accesses_apply(struct smack_accesses *handle, int clear);
+static int accesses_merge(struct smack_accesses *handle,
+			  struct smack_label *subject_label, int clear);
 static int accesses_print(struct smack_accesses *handle,
 			  int clear, int use_long, int multiline,
 			  struct smack_file_buffer *load_buffer,
@@ -146,6 +242,11 @@ static inline ssize_t get_label(char *dest, const char *src, unsigned int *hash)
 static inline int str_to_access_code(const char *str);
 static inline void access_code_to_str(unsigned code, char *str);
 static struct smack_label *label_add(struct smack_accesses *handle, const char *src);
+static const char *label_copy(struct label_chunk **chunks, const char *label,
+			      int len);
+static void label_chunks_free(struct label_chunk *chunk);
+static smack_label_id policy_label_id(struct smack_policy *policy,
+				      const char *label, uint32_t hash);
 
 int smack_accesses_new(struct smack_accesses **accesses)
 {
@@ -198,10 +299,10 @@ void smack_accesses_free(struct smack_accesses *handle)
 			free(rule);
 			rule = next_rule;
 		}
-		free(handle->labels[i]->label);
 		free(handle->labels[i]);
 	}
 
+	label_chunks_free(handle->label_chunks);
 	free(handle->label_hash);
 	free(handle->merge_object_ids);
 	free(handle->merge_perms);
@@ -235,25 +336,18 @@ int smack_accesses_clear(struct smack_accesses *handle)
 	return accesses_apply(handle, 1);
 }
 
-static int accesses_add(struct smack_accesses *handle, const char *subject,
-		 const char *object, const char *allow_access_type,
-		 const char *deny_access_type)
+static int accesses_add_labels(struct smack_accesses *handle,
+			       struct smack_label *subject_label,
+			       struct smack_label *object_label,
+			       const char *allow_access_type,
+			       const char *deny_access_type)
 {
 	struct smack_rule *rule;
-	struct smack_label *subject_label;
-	struct smack_label *object_label;
 
 	rule = calloc(sizeof(struct smack_rule), 1);
 	if (rule == NULL)
 		return -1;
 
-	subject_label = label_add(handle, subject);
-	if (subject_label == NULL)
-		goto err_out;
-	object_label = label_add(handle, object);
-	if (object_label == NULL)
-		goto err_out;
-
 	if (subject_label->len > SHORT_LABEL_LEN ||
 	    object_label->len > SHORT_LABEL_LEN)
 		handle->has_long = 1;
@@ -284,6 +378,24 @@ err_out:
 	return -1;
 }
 
+static int accesses_add(struct smack_accesses *handle, const char *subject,
+		 const char *object, const char *allow_access_type,
+		 const char *deny_access_type)
+{
+	struct smack_label *subject_label;
+	struct smack_label *object_label;
+
+	subject_label = label_add(handle, subject);
+	if (subject_label == NULL)
+		return -1;
+	object_label = label_add(handle, object);
+	if (object_label == NULL)
+		return -1;
+
+	return accesses_add_labels(handle, subject_label, object_label,
+				   allow_access_type, deny_access_type);
+}
+
 int smack_accesses_add(struct smack_accesses *handle, const char *subject,
 		       const char *object, const char *access_type)
 {
@@ -353,8 +465,9 @@ err_out:
 	return -1;
 }
 
-int smack_have_access(const char *subject, const char *object,
-		      const char *access_type)
+static int have_access(const char *subject, ssize_t slen,
+		       const char *object, ssize_t olen,
+		       const char *access_type)
 {
 	char buf[LOAD_LEN + 1];
 	char str[ACC_LEN + 1];
@@ -362,17 +475,10 @@ int smack_have_access(const char *subject, const char *object,
 	int ret;
 	int fd;
 	int use_long = 1;
-	ssize_t slen;
-	ssize_t olen;
-
-	if (init_smackfs_mnt())
-		return -1;
-
-	slen = get_label(NULL, subject, NULL);
-	olen = get_label(NULL, object, NULL);
 
-	if (slen < 0 || olen < 0)
+	if ((code = str_to_access_code(access_type)) < 0)
 		return -1;
+	access_code_to_str(code, str);
 
 	fd = open_smackfs_file("access2", "access", O_RDWR, &use_long);
 	if (fd < 0)
@@ -383,10 +489,6 @@ int smack_have_access(const char *subject, const char *object,
 		return -1;
 	}
 
-	if ((code = str_to_access_code(access_type)) < 0)
-		return -1;
-	access_code_to_str(code, str);
-
 	if (use_long)
 		ret = snprintf(buf, LOAD_LEN + 1, KERNEL_LONG_FORMAT,
 			       subject, object, str);
@@ -399,7 +501,7 @@ int smack_have_access(const char *subject, const char *object,
 		return -1;
 	}
 
-	ret = write(fd, buf, strlen(buf));
+	ret = write(fd, buf, ret);
 	if (ret < 0) {
 		close(fd);
 		return -1;
@@ -413,234 +515,1323 @@ int smack_have_access(const char *subject, const char *object,
 	return buf[0] == '1';
 }
 
-int smack_cipso_new(struct smack_cipso **cipso)
+int smack_have_access(const char *subject, const char *object,
+		      const char *access_type)
 {
-	struct smack_cipso *result;
+	ssize_t slen;
+	ssize_t olen;
 
-	result = calloc(sizeof(struct smack_cipso), 1);
-	if (result == NULL)
+	if (init_smackfs_mnt())
 		return -1;
 
-	*cipso = result;
-	return 0;
+	slen = get_label(NULL, subject, NULL);
+	olen = get_label(NULL, object, NULL);
+
+	if (slen < 0 || olen < 0)
+		return -1;
+
+	return have_access(subject, slen, object, olen, access_type);
 }
 
-void smack_cipso_free(struct smack_cipso *cipso)
+smack_label_id smack_accesses_label_id(struct smack_accesses *handle,
+				       const char *label)
 {
-	if (cipso == NULL)
-		return;
+	struct smack_label *lab;
 
-	struct cipso_mapping *mapping = cipso->first;
-	struct cipso_mapping *next_mapping = NULL;
+	lab = label_add(handle, label);
+	if (lab == NULL)
+		return -1;
 
-	while (mapping != NULL) {
-		next_mapping = mapping->next;
-		free(mapping);
-		mapping = next_mapping;
-	}
+	return lab->id;
+}
 
-	free(cipso);
+static inline struct smack_label *label_by_id(struct smack_accesses *handle,
+					      smack_label_id id)
+{
+	if (id < 0 || id >= handle->labels_cnt)
+		return NULL;
+	return handle->labels[id];
 }
 
-int smack_cipso_apply(struct smack_cipso *cipso)
+const char *smack_accesses_label(struct smack_accesses *handle,
+				 smack_label_id id)
 {
-	struct cipso_mapping *m = NULL;
-	char buf[CIPSO_MAX_SIZE];
-	int fd;
-	int i;
-	int offset;
-	int use_long;
-	int ret;
-	int buf_len = sizeof(buf);
+	struct smack_label *lab = label_by_id(handle, id);
 
-	if (init_smackfs_mnt())
+	return lab ? lab->label : NULL;
+}
+
+int smack_accesses_add_by_id(struct smack_accesses *handle,
+			     smack_label_id subject_id,
+			     smack_label_id object_id,
+			     const char *access_type)
+{
+	return smack_accesses_add_modify_by_id(handle, subject_id, object_id,
+					       access_type, NULL);
+}
+
+int smack_accesses_add_modify_by_id(struct smack_accesses *handle,
+				    smack_label_id subject_id,
+				    smack_label_id object_id,
+				    const char *allow_access_type,
+				    const char *deny_access_type)
+{
+	struct smack_label *subject_label = label_by_id(handle, subject_id);
+	struct smack_label *object_label = label_by_id(handle, object_id);
+
+	if (subject_label == NULL || object_label == NULL)
 		return -1;
 
-	fd = open_smackfs_file("cipso2", "cipso", O_WRONLY, &use_long);
-	if (fd < 0)
+	return accesses_add_labels(handle, subject_label, object_label,
+				   allow_access_type, deny_access_type);
+}
+
+int smack_have_access_by_id(struct smack_accesses *handle,
+			    smack_label_id subject_id,
+			    smack_label_id object_id,
+			    const char *access_type)
+{
+	struct smack_label *subject_label = label_by_id(handle, subject_id);
+	struct smack_label *object_label = label_by_id(handle, object_id);
+
+	if (subject_label == NULL || object_label == NULL)
 		return -1;
 
-	if (!use_long && cipso->has_long)
-		goto err_out;
+	if (init_smackfs_mnt())
+		return -1;
 
-	for (m = cipso->first; m != NULL; m = m->next) {
-		if (use_long) {
-			ret = snprintf(buf, SMACK_LABEL_LEN + 1, "%s", m->label);
-			if (ret < 0 || ret > SMACK_LABEL_LEN)
-				goto err_out;
-		} else {
-			ret = snprintf(buf, SHORT_LABEL_LEN + 1, "%-23s", m->label);
-			if (ret < 0 || ret > SHORT_LABEL_LEN)
-				goto err_out;
-		}
+	return have_access(subject_label->label, subject_label->len,
+			   object_label->label, object_label->len,
+			   access_type);
+}
 
-		offset = ret;
-		buf[offset++] = ' ';
+static inline uint32_t table_size(uint32_t cnt)
+{
+	uint32_t size = 16;
 
-		ret = snprintf(buf + offset, buf_len - offset, CIPSO_NUM_LEN_STR, m->level);
-		if (ret < 0 || offset + ret >= buf_len)
-			goto err_out;
-		offset += ret;
+	/* Keep open addressing tables at most half full. */
+	while (size < 2 * cnt)
+		size <<= 1;
+	return size;
+}
 
-		ret = snprintf(buf + offset, buf_len - offset, CIPSO_NUM_LEN_STR, m->ncats);
-		if (ret < 0 || offset + ret >= buf_len)
-			goto err_out;
-		offset += ret;
+static inline uint32_t decision_hash(smack_label_id subject_id,
+				     smack_label_id object_id)
+{
+	uint32_t h = (uint32_t)subject_id * 0x9e3779b1u;
+
+	h ^= (uint32_t)object_id + 0x7f4a7c15u + (h << 6) + (h >> 2);
+	return h ^ (h >> 16);
+}
+
+static void policy_add_decisions(struct smack_policy *policy,
+				 struct smack_accesses *handle)
+{
+	struct smack_decision *d;
+	union smack_perm *perm;
+	smack_label_id object_id;
+	int merge_cnt;
+	int x;
+	int y;
+	uint32_t h;
 
-		for (i = 0; i < CAT_MAX_COUNT; i++) {
-			if (BITTEST(m->cats, i)) {
-				ret = snprintf(buf + offset, buf_len - offset,
-					CIPSO_NUM_LEN_STR, i + 1);
-				if (ret < 0 || offset + ret >= buf_len)
-					goto err_out;
-				offset += ret;
+	bzero(handle->merge_perms, handle->labels_cnt * sizeof(union smack_perm));
+	for (x = 0; x < handle->labels_cnt; ++x) {
+		merge_cnt = accesses_merge(handle, handle->labels[x], 0);
+		for (y = 0; y < merge_cnt; ++y) {
+			object_id = handle->merge_object_ids[y];
+			perm = &(handle->merge_perms[object_id]);
+
+			/* Rules without any access never grant anything. */
+			if (perm->allow_code != 0) {
+				h = decision_hash(x, object_id);
+				for (;; ++h) {
+					d = &policy->decisions[h & policy->decision_mask];
+					if (d->subject_id < 0 ||
+					    (d->subject_id == x &&
+					     d->object_id == object_id))
+						break;
+				}
+				if (d->subject_id < 0)
+					++policy->decisions_cnt;
+				d->subject_id = x;
+				d->object_id = object_id;
+				d->code = perm->allow_code;
 			}
+			perm->allow_deny_code = 0;
 		}
+	}
+}
 
-		if (write(fd, buf, offset) < 0)
-			goto err_out;
+static void rule_index_free(struct smack_rule_index *index)
+{
+	free(index->ids);
+	free(index->groups);
+	free(index->offsets);
+}
+
+/* Build the index of 'cnt' decisions keyed by their subject or object.
+ * Decisions are counting sorted by access code first and then, stably, by
+ * the key label, so that every label gets its rules grouped by code. */
+static int rule_index_build(struct smack_rule_index *index, int labels_cnt,
+			    const struct smack_decision *list, uint32_t cnt,
+			    int by_object)
+{
+	uint32_t code_pos[ACCESS_TYPE_ALL + 2];
+	uint32_t *by_code = NULL;
+	uint32_t *key_pos = NULL;
+	uint32_t groups_cnt = 0;
+	const struct smack_decision *d;
+	smack_label_id key;
+	smack_label_id prev_key = -1;
+	int prev_code = -1;
+	uint32_t pos;
+	uint32_t i;
+	int c;
+
+	index->offsets = calloc(labels_cnt + 1, sizeof(uint32_t));
+	index->ids = malloc((cnt + 1) * sizeof(smack_label_id));
+	by_code = malloc((cnt + 1) * sizeof(uint32_t));
+	key_pos = calloc(labels_cnt + 1, sizeof(uint32_t));
+	if (index->offsets == NULL || index->ids == NULL ||
+	    by_code == NULL || key_pos == NULL)
+		goto err_out;
+
+	memset(code_pos, 0, sizeof(code_pos));
+	for (i = 0; i < cnt; ++i) {
+		++code_pos[list[i].code + 1];
+		++key_pos[(by_object ? list[i].object_id : list[i].subject_id) + 1];
 	}
+	for (c = 1; c <= ACCESS_TYPE_ALL + 1; ++c)
+		code_pos[c] += code_pos[c - 1];
+	for (key = 1; key <= labels_cnt; ++key)
+		key_pos[key] += key_pos[key - 1];
 
-	close(fd);
+	for (i = 0; i < cnt; ++i)
+		by_code[code_pos[list[i].code]++] = i;
+
+	/* Reuse 'ids' for the decision order, then fill in the labels. */
+	for (i = 0; i < cnt; ++i) {
+		d = &list[by_code[i]];
+		key = by_object ? d->object_id : d->subject_id;
+		index->ids[key_pos[key]++] = by_code[i];
+	}
+
+	for (i = 0; i < cnt; ++i) {
+		d = &list[index->ids[i]];
+		key = by_object ? d->object_id : d->subject_id;
+		if (key != prev_key || d->code != prev_code)
+			++groups_cnt;
+		prev_key = key;
+		prev_code = d->code;
+	}
+
+	index->groups = malloc((groups_cnt + 1) * sizeof(struct smack_rule_group));
+	if (index->groups == NULL)
+		goto err_out;
+
+	prev_key = -1;
+	prev_code = -1;
+	groups_cnt = 0;
+	for (i = 0; i < cnt; ++i) {
+		d = &list[index->ids[i]];
+		key = by_object ? d->object_id : d->subject_id;
+		if (key != prev_key || d->code != prev_code) {
+			index->groups[groups_cnt].code = d->code;
+			index->groups[groups_cnt].start = i;
+			for (pos = prev_key + 1; (smack_label_id)pos <= key; ++pos)
+				index->offsets[pos] = groups_cnt;
+			++groups_cnt;
+		}
+		prev_key = key;
+		prev_code = d->code;
+		index->ids[i] = by_object ? d->subject_id : d->object_id;
+	}
+	for (pos = prev_key + 1; (smack_label_id)pos <= labels_cnt; ++pos)
+		index->offsets[pos] = groups_cnt;
+	index->groups[groups_cnt].code = 0;
+	index->groups[groups_cnt].start = cnt;
+
+	free(key_pos);
+	free(by_code);
 	return 0;
 
 err_out:
-	close(fd);
+	free(key_pos);
+	free(by_code);
+	rule_index_free(index);
+	index->offsets = NULL;
+	index->groups = NULL;
+	index->ids = NULL;
 	return -1;
 }
 
-int smack_cipso_add_from_file(struct smack_cipso *cipso, int fd)
+static int policy_build_indexes(struct smack_policy *policy)
 {
-	struct cipso_mapping *mapping = NULL;
-	FILE *file = NULL;
-	char *buf = NULL;
-	size_t buf_size = 0;
-	char *label, *level, *cat, *ptr;
-	long int val;
-	int i;
-	int newfd;
-
-	newfd = dup(fd);
-	if (newfd == -1)
-		return -1;
+	struct smack_decision *list;
+	uint32_t cnt = 0;
+	uint32_t i;
+	int ret;
 
-	file = fdopen(newfd, "r");
-	if (file == NULL) {
-		close(newfd);
+	list = malloc((policy->decisions_cnt + 1) * sizeof(struct smack_decision));
+	if (list == NULL)
 		return -1;
-	}
-
-	while (getline(&buf, &buf_size, file) >= 0) {
-		mapping = calloc(sizeof(struct cipso_mapping), 1);
-		if (mapping == NULL)
-			goto err_out;
-
-		label = strtok_r(buf, " \t\n", &ptr);
-		level = strtok_r(NULL, " \t\n", &ptr);
-		cat = strtok_r(NULL, " \t\n", &ptr);
-
-		if (level == NULL)
-			goto err_out;
 
-		val  = get_label(mapping->label, label, NULL);
-		if (val < 0)
-			goto err_out;
-		if (val > SHORT_LABEL_LEN)
-			cipso->has_long = 1;
+	for (i = 0; i <= policy->decision_mask; ++i)
+		if (policy->decisions[i].subject_id >= 0)
+			list[cnt++] = policy->decisions[i];
 
-		errno = 0;
-		val = strtol(level, NULL, 10);
-		if (errno)
-			goto err_out;
+	ret = rule_index_build(&policy->by_subject, policy->labels_cnt,
+			       list, cnt, 0);
+	if (ret == 0)
+		ret = rule_index_build(&policy->by_object, policy->labels_cnt,
+				       list, cnt, 1);
 
-		if (val < 0 || val > LEVEL_MAX)
-			goto err_out;
+	free(list);
+	return ret;
+}
 
-		mapping->level = val;
+int smack_policy_new(struct smack_policy **policy,
+		     struct smack_accesses *handle)
+{
+	struct smack_policy *result;
+	struct smack_rule *rule;
+	size_t data_len = 0;
+	uint32_t rules_cnt = 0;
+	uint32_t size;
+	uint32_t h = 0;
+	char *data;
+	int i;
 
-		for (i = 0; i < CAT_MAX_COUNT && cat != NULL; i++) {
-			errno = 0;
-			val = strtol(cat, NULL, 10);
-			if (errno)
-				goto err_out;
+	result = calloc(1, sizeof(struct smack_policy));
+	if (result == NULL)
+		return -1;
 
-			if (val <= 0 || val > CAT_MAX_COUNT)
-				goto err_out;
+	for (i = 0; i < handle->labels_cnt; ++i) {
+		data_len += handle->labels[i]->len + 1;
+		for (rule = handle->labels[i]->first_rule; rule != NULL;
+		     rule = rule->next_rule)
+			++rules_cnt;
+	}
 
-			if (!BITTEST(mapping->cats, val - 1)) {
-				BITSET(mapping->cats, val - 1);
-				++(mapping->ncats);
-			}
+	result->labels_cnt = handle->labels_cnt;
+	result->labels = malloc((handle->labels_cnt + 1) * sizeof(char *));
+	result->label_data = malloc(data_len + 1);
+	size = table_size(handle->labels_cnt);
+	result->label_mask = size - 1;
+	result->label_table = malloc(size * sizeof(smack_label_id));
+	size = table_size(rules_cnt);
+	result->decision_mask = size - 1;
+	result->decisions = malloc(size * sizeof(struct smack_decision));
+	if (result->labels == NULL || result->label_data == NULL ||
+	    result->label_table == NULL || result->decisions == NULL)
+		goto err_out;
 
-			cat = strtok_r(NULL, " \t\n", &ptr);
-		}
+	memset(result->label_table, 0xff,
+	       (result->label_mask + 1) * sizeof(smack_label_id));
+	memset(result->decisions, 0xff,
+	       (result->decision_mask + 1) * sizeof(struct smack_decision));
 
-		if (cipso->first == NULL) {
-			cipso->first = cipso->last = mapping;
-		} else {
-			cipso->last->next = mapping;
-			cipso->last = mapping;
-		}
+	data = result->label_data;
+	for (i = 0; i < handle->labels_cnt; ++i) {
+		memcpy(data, handle->labels[i]->label, handle->labels[i]->len + 1);
+		result->labels[i] = data;
+		data += handle->labels[i]->len + 1;
+
+		get_label(NULL, result->labels[i], &h);
+		while (result->label_table[h & result->label_mask] >= 0)
+			++h;
+		result->label_table[h & result->label_mask] = i;
 	}
 
-	if (ferror(file))
+	policy_add_decisions(result, handle);
+
+	if (policy_build_indexes(result))
 		goto err_out;
 
-	fclose(file);
-	free(buf);
+	*policy = result;
 	return 0;
+
 err_out:
-	fclose(file);
-	free(mapping);
-	free(buf);
+	smack_policy_free(result);
 	return -1;
 }
 
-const char *smack_smackfs_path(void)
+void smack_policy_free(struct smack_policy *policy)
 {
-	if (init_smackfs_mnt())
-		return NULL;
-	return smackfs_mnt;
+	if (policy == NULL)
+		return;
+
+	rule_index_free(&policy->by_subject);
+	rule_index_free(&policy->by_object);
+	free(policy->decisions);
+	free(policy->label_table);
+	free(policy->label_data);
+	free(policy->labels);
+	free(policy);
 }
 
-static ssize_t smack_new_label_from_proc(const char *proc_path, char **label)
+static smack_label_id policy_label_id(struct smack_policy *policy,
+				      const char *label, uint32_t hash)
 {
-	char buf[SMACK_LABEL_LEN + 1];
-	char *result;
-	int fd;
-	int ret;
+	smack_label_id id;
 
-	fd = open(proc_path, O_RDONLY);
-	if (fd < 0)
-		return -1;
+	for (;; ++hash) {
+		id = policy->label_table[hash & policy->label_mask];
+		if (id < 0 || strcmp(policy->labels[id], label) == 0)
+			return id;
+	}
+}
 
-	ret = read(fd, buf, SMACK_LABEL_LEN);
-	close(fd);
-	if (ret < 0)
-		return -1;
+static inline int is_builtin_label(const char *label, char c)
+{
+	return label[0] == c && label[1] == '\0';
+}
 
-	buf[ret] = '\0';
+/* Decide access the same way the kernel does in smk_access(). Labels not
+ * known to the policy have a negative id and can get access only through
+ * the built-in rules. */
+static int policy_check(struct smack_policy *policy,
+			const char *subject, smack_label_id subject_id,
+			const char *object, smack_label_id object_id,
+			int code)
+{
+	struct smack_decision *d;
+	uint32_t h;
 
-	result = calloc(ret + 1, 1);
-	if (result == NULL)
+	if (is_builtin_label(subject, '*'))
+		return 0;
+	if (is_builtin_label(object, '@') || is_builtin_label(subject, '@'))
+		return 1;
+	if (is_builtin_label(object, '*'))
+		return 1;
+	if (subject_id >= 0 ? subject_id == object_id : !strcmp(subject, object))
+		return 1;
+	if ((code & (ACCESS_TYPE_R | ACCESS_TYPE_X)) == code ||
+	    (code & ACCESS_TYPE_L) == code) {
+		if (is_builtin_label(object, '_'))
+			return 1;
+		if (is_builtin_label(subject, '^'))
+			return 1;
+	}
+
+	if (subject_id < 0 || object_id < 0)
+		return 0;
+
+	for (h = decision_hash(subject_id, object_id);; ++h) {
+		d = &policy->decisions[h & policy->decision_mask];
+		if (d->subject_id < 0)
+			return 0;
+		if (d->subject_id == subject_id && d->object_id == object_id)
+			return (d->code & code) == code;
+	}
+}
+
+int smack_policy_have_access(struct smack_policy *policy, const char *subject,
+			     const char *object, const char *access_type)
+{
+	uint32_t shash;
+	uint32_t ohash;
+	int code;
+
+	if (get_label(NULL, subject, &shash) < 0 ||
+	    get_label(NULL, object, &ohash) < 0)
 		return -1;
 
-	ret = get_label(result, buf, NULL);
-	if (ret < 0) {
+	code = str_to_access_code(access_type);
+	if (code < 0)
+		return -1;
+
+	return policy_check(policy,
+			    subject, policy_label_id(policy, subject, shash),
+			    object, policy_label_id(policy, object, ohash),
+			    code);
+}
+
+int smack_policy_have_access_by_id(struct smack_policy *policy,
+				   smack_label_id subject_id,
+				   smack_label_id object_id,
+				   const char *access_type)
+{
+	int code;
+
+	if (subject_id < 0 || subject_id >= policy->labels_cnt ||
+	    object_id < 0 || object_id >= policy->labels_cnt)
+		return -1;
+
+	code = str_to_access_code(access_type);
+	if (code < 0)
+		return -1;
+
+	return policy_check(policy,
+			    policy->labels[subject_id], subject_id,
+			    policy->labels[object_id], object_id,
+			    code);
+}
+
+int smack_policy_new_from_kernel(struct smack_policy **policy)
+{
+	struct smack_accesses *handle = NULL;
+	int use_long = 1;
+	int ret;
+	int fd;
+
+	if (init_smackfs_mnt())
+		return -1;
+
+	fd = open_smackfs_file("load2", "load", O_RDONLY, &use_long);
+	if (fd < 0)
+		return -1;
+
+	ret = smack_accesses_new(&handle);
+	if (ret == 0)
+		ret = smack_accesses_add_from_file(handle, fd);
+	if (ret == 0)
+		ret = smack_policy_new(policy, handle);
+
+	smack_accesses_free(handle);
+	close(fd);
+	return ret;
+}
+
+static int rule_index_walk(struct smack_policy *policy,
+			   struct smack_rule_index *index,
+			   const char *label, const char *access_type,
+			   smack_label_fn fn, void *data)
+{
+	struct smack_rule_group *group;
+	struct smack_rule_group *end;
+	smack_label_id id;
+	uint32_t hash;
+	uint32_t i;
+	int code;
+	int cnt = 0;
+
+	if (get_label(NULL, label, &hash) < 0)
+		return -1;
+
+	code = str_to_access_code(access_type);
+	if (code < 0)
+		return -1;
+
+	id = policy_label_id(policy, label, hash);
+	if (id < 0)
+		return 0;
+
+	end = &index->groups[index->offsets[id + 1]];
+	for (group = &index->groups[index->offsets[id]]; group < end; ++group) {
+		if ((group->code & code) != code)
+			continue;
+		for (i = group->start; i < group[1].start; ++i) {
+			++cnt;
+			if (fn(policy->labels[index->ids[i]], index->ids[i], data))
+				return cnt;
+		}
+	}
+
+	return cnt;
+}
+
+int smack_policy_for_each_subject(struct smack_policy *policy,
+				  const char *object, const char *access_type,
+				  smack_label_fn fn, void *data)
+{
+	return rule_index_walk(policy, &policy->by_object, object, access_type,
+			       fn, data);
+}
+
+int smack_policy_for_each_object(struct smack_policy *policy,
+				 const char *subject, const char *access_type,
+				 smack_label_fn fn, void *data)
+{
+	return rule_index_walk(policy, &policy->by_subject, subject, access_type,
+			       fn, data);
+}
+
+static unsigned int reader_slot_next;
+static __thread int reader_slot = -1;
+
+int smack_shared_policy_new(struct smack_shared_policy **shared)
+{
+	struct smack_shared_policy *result;
+
+	if (posix_memalign((void **)&result, CACHE_LINE_SIZE,
+			   sizeof(struct smack_shared_policy)))
+		return -1;
+
+	memset(result, 0, sizeof(struct smack_shared_policy));
+	if (pthread_mutex_init(&result->writer_lock, NULL)) {
 		free(result);
 		return -1;
 	}
 
+	*shared = result;
+	return 0;
+}
+
+void smack_shared_policy_free(struct smack_shared_policy *shared)
+{
+	if (shared == NULL)
+		return;
+
+	smack_policy_free(shared->current);
+	pthread_mutex_destroy(&shared->writer_lock);
+	free(shared);
+}
+
+static void wait_for_readers(struct smack_shared_policy *shared, int phase)
+{
+	int i;
+
+	for (i = 0; i < READER_SLOTS; ++i)
+		while (__atomic_load_n(&shared->slots[i].count[phase],
+				       __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+}
+
+int smack_shared_policy_publish(struct smack_shared_policy *shared,
+				struct smack_policy *policy)
+{
+	struct smack_policy *old;
+	int phase;
+
+	if (pthread_mutex_lock(&shared->writer_lock))
+		return -1;
+
+	old = __atomic_exchange_n(&shared->current, policy, __ATOMIC_SEQ_CST);
+
+	/* Readers that entered before the phase flip may still use the old
+	 * snapshot, new readers are counted in the other phase and can only
+	 * see the new one. */
+	phase = shared->phase;
+	__atomic_store_n(&shared->phase, !phase, __ATOMIC_SEQ_CST);
+	wait_for_readers(shared, phase);
+
+	pthread_mutex_unlock(&shared->writer_lock);
+	smack_policy_free(old);
+	return 0;
+}
+
+struct smack_policy *smack_shared_policy_enter(struct smack_shared_policy *shared,
+					       int *token)
+{
+	int slot = reader_slot;
+	int phase;
+
+	if (slot < 0) {
+		slot = __atomic_fetch_add(&reader_slot_next, 1,
+					  __ATOMIC_RELAXED) % READER_SLOTS;
+		reader_slot = slot;
+	}
+
+	/* A writer may flip the phase between its load and the increment, the
+	 * reader would then be counted in a phase nobody waits for. Once the
+	 * phase is seen unchanged after the increment, the next flip happens
+	 * after it and the writer waits for this reader. */
+	for (;;) {
+		phase = __atomic_load_n(&shared->phase, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&shared->slots[slot].count[phase], 1,
+				   __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&shared->phase, __ATOMIC_SEQ_CST) == phase)
+			break;
+		__atomic_fetch_sub(&shared->slots[slot].count[phase], 1,
+				   __ATOMIC_SEQ_CST);
+	}
+	*token = slot * 2 + phase;
+
+	return __atomic_load_n(&shared->current, __ATOMIC_SEQ_CST);
+}
+
+void smack_shared_policy_leave(struct smack_shared_policy *shared, int token)
+{
+	__atomic_fetch_sub(&shared->slots[token / 2].count[token % 2], 1,
+			   __ATOMIC_RELEASE);
+}
+
+int smack_shared_policy_have_access(struct smack_shared_policy *shared,
+				    const char *subject, const char *object,
+				    const char *access_type)
+{
+	struct smack_policy *policy;
+	int token;
+	int ret = -1;
+
+	policy = smack_shared_policy_enter(shared, &token);
+	if (policy != NULL)
+		ret = smack_policy_have_access(policy, subject, object,
+					       access_type);
+	smack_shared_policy_leave(shared, token);
+
+	return ret;
+}
+
+int smack_cipso_new(struct smack_cipso **cipso)
+{
+	struct smack_cipso *result;
+
+	result = calloc(sizeof(struct smack_cipso), 1);
+	if (result == NULL)
+		return -1;
+
+	*cipso = result;
+	return 0;
+}
+
+void smack_cipso_free(struct smack_cipso *cipso)
+{
+	if (cipso == NULL)
+		return;
+
+	label_chunks_free(cipso->label_chunks);
+	free(cipso->mappings);
+	free(cipso->index);
+	free(cipso);
+}
+
+/* slot of the index for label */
+static int *cipso_slot(const struct smack_cipso *cipso, const char *label,
+		       unsigned int hash)
+{
+	const struct cipso_mapping *m;
+	unsigned int i;
+
+	for (i = hash & cipso->index_mask; cipso->index[i];
+	     i = (i + 1) & cipso->index_mask) {
+		m = &cipso->mappings[cipso->index[i] - 1];
+		if (m->hash == hash && !strcmp(m->label, label))
+			break;
+	}
+	return &cipso->index[i];
+}
+
+/* add a mapping, replacing the previous one of the same label, the label
+ * is copied into the handle when it is new */
+static int cipso_add(struct smack_cipso *cipso,
+		     const struct cipso_mapping *mapping)
+{
+	struct cipso_mapping *mappings;
+	const char *label;
+	unsigned int mask;
+	int *index;
+	int *slot;
+	int i;
+
+	if (2 * (cipso->mappings_cnt + 1) > (int)cipso->index_mask + 1) {
+		mask = cipso->index_mask ? 2 * cipso->index_mask + 1 : 255;
+		index = calloc(mask + 1, sizeof(int));
+		if (index == NULL)
+			return -1;
+		free(cipso->index);
+		cipso->index = index;
+		cipso->index_mask = mask;
+		for (i = 0; i < cipso->mappings_cnt; i++)
+			*cipso_slot(cipso, cipso->mappings[i].label,
+				    cipso->mappings[i].hash) = i + 1;
+	}
+
+	slot = cipso_slot(cipso, mapping->label, mapping->hash);
+	if (*slot) {
+		label = cipso->mappings[*slot - 1].label;
+		cipso->mappings[*slot - 1] = *mapping;
+		cipso->mappings[*slot - 1].label = label;
+		return 0;
+	}
+
+	if (cipso->mappings_cnt == cipso->mappings_alloc) {
+		i = cipso->mappings_alloc ? 2 * cipso->mappings_alloc : 128;
+		mappings = realloc(cipso->mappings,
+				   i * sizeof(struct cipso_mapping));
+		if (mappings == NULL)
+			return -1;
+		cipso->mappings = mappings;
+		cipso->mappings_alloc = i;
+	}
+
+	label = label_copy(&cipso->label_chunks, mapping->label,
+			   strlen(mapping->label));
+	if (label == NULL)
+		return -1;
+
+	cipso->mappings[cipso->mappings_cnt] = *mapping;
+	cipso->mappings[cipso->mappings_cnt++].label = label;
+	*slot = cipso->mappings_cnt;
+	return 0;
+}
+
+/* digits of the numbers from 0 to 99 */
+static const char digit_pairs[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* write a number of a CIPSO record left aligned in NUM_LEN columns */
+static inline char *cipso_num(char *p, unsigned int n)
+{
+	char *end = p + NUM_LEN;
+
+	if (n >= 100) {
+		*p++ = '0' + n / 100;
+		n %= 100;
+		memcpy(p, &digit_pairs[2 * n], 2);
+		p += 2;
+	} else if (n >= 10) {
+		memcpy(p, &digit_pairs[2 * n], 2);
+		p += 2;
+	} else {
+		*p++ = '0' + n;
+	}
+	while (p < end)
+		*p++ = ' ';
+	return p;
+}
+
+/* format the record of a mapping for the cipso2 (or cipso if !use_long)
+ * interface, return its length */
+static int cipso_format(char *buf, const struct cipso_mapping *m,
+			int use_long)
+{
+	size_t len = strlen(m->label);
+	unsigned int bits;
+	char *p = buf;
+	int i;
+
+	if (use_long) {
+		memcpy(p, m->label, len);
+		p += len;
+	} else {
+		if (len > SHORT_LABEL_LEN)
+			return -1;
+		memcpy(p, m->label, len);
+		memset(p + len, ' ', SHORT_LABEL_LEN - len);
+		p += SHORT_LABEL_LEN;
+	}
+	*p++ = ' ';
+
+	p = cipso_num(p, m->level);
+	p = cipso_num(p, m->ncats);
+	/* only walk the set bits of the categories */
+	for (i = 0; i < BITNSLOTS(CAT_MAX_COUNT); i++)
+		for (bits = m->cats[i]; bits; bits &= bits - 1)
+			p = cipso_num(p, i * 8 + __builtin_ctz(bits) + 1);
+
+	return p - buf;
+}
+
+static inline int check_cipso_multiline(int fd, const struct cipso_mapping *m)
+{
+	/* Same as check_multiline(): the first record is the first mapping,
+	 * that is set anyway, and the second has an invalid label. The write
+	 * succeeds if kernel only parses the first record.
+	 */
+	char buf[CIPSO_MAX_SIZE + 3];
+	int len;
+
+	len = cipso_format(buf, m, 1);
+	memcpy(buf + len, "\n-", 2);
+	len += 2;
+
+	if (write(fd, buf, len) < 0)
+		return errno == EINVAL ? 1 : -1;
+	return 0;
+}
+
+/* write the mappings to the kernel, but those whose skip flag is set */
+static int cipso_write(struct smack_cipso *cipso, const uint8_t *skip)
+{
+	struct cipso_mapping *m;
+	char *buf = NULL;
+	size_t buf_len = CIPSO_MAX_SIZE;
+	size_t offset = 0;
+	int multiline = 0;
+	int first = -1;
+	int last = -1;
+	int done = -1;
+	int cnt = 0;
+	int fd;
+	int use_long;
+	int ret;
+	int i;
+
+	for (i = 0; i < cipso->mappings_cnt; i++) {
+		if (skip && skip[i])
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+		cnt++;
+	}
+	if (cnt == 0)
+		return 0;
+
+	if (init_smackfs_mnt())
+		return -1;
+
+	fd = open_smackfs_file("cipso2", "cipso", O_WRONLY, &use_long);
+	if (fd < 0)
+		return -1;
+
+	if (!use_long && cipso->has_long)
+		goto err_out;
+
+	if (use_long && cnt > 1) {
+		multiline = check_cipso_multiline(fd, &cipso->mappings[first]);
+		if (multiline < 0)
+			goto err_out;
+		/* the first mapping is set unless several can be */
+		if (!multiline)
+			done = first;
+	}
+
+	if (multiline)
+		buf_len = sysconf(_SC_PAGESIZE) + CIPSO_MAX_SIZE;
+	buf = malloc(buf_len);
+	if (buf == NULL)
+		goto err_out;
+
+	for (i = first; i <= last; i++) {
+		if ((skip && skip[i]) || i == done)
+			continue;
+		m = &cipso->mappings[i];
+		ret = cipso_format(buf + offset, m, use_long);
+		if (ret < 0)
+			goto err_out;
+		offset += ret;
+		if (multiline)
+			buf[offset++] = '\n';
+
+		if (!multiline || i == last ||
+		    offset + CIPSO_MAX_SIZE + 1 > buf_len) {
+			if (write(fd, buf, offset) < 0)
+				goto err_out;
+			offset = 0;
+		}
+	}
+
+	free(buf);
+	close(fd);
+	return 0;
+
+err_out:
+	free(buf);
+	close(fd);
+	return -1;
+}
+
+int smack_cipso_apply(struct smack_cipso *cipso)
+{
+	return cipso_write(cipso, NULL);
+}
+
+/* index of the mapping of label, or -1 */
+static int cipso_find(const struct smack_cipso *cipso, const char *label)
+{
+	unsigned int hash;
+	unsigned int i;
+
+	if (cipso->index == NULL || get_label(NULL, label, &hash) < 0)
+		return -1;
+
+	for (i = hash & cipso->index_mask; cipso->index[i];
+	     i = (i + 1) & cipso->index_mask)
+		if (!strcmp(cipso->mappings[cipso->index[i] - 1].label, label))
+			return cipso->index[i] - 1;
+	return -1;
+}
+
+/* parse a line of the cipso2 (or cipso) interface, "label level/c1,c2",
+ * into the mapping without its label, return the label or NULL if the
+ * line isn't a mapping that can be defined */
+static char *cipso_parse_kernel(char *line, struct cipso_mapping *mapping)
+{
+	char *label, *level, *ptr;
+	long val;
+
+	memset(mapping, 0, sizeof(struct cipso_mapping));
+
+	label = strtok_r(line, " \n", &level);
+	if (label == NULL || level == NULL)
+		return NULL;
+
+	errno = 0;
+	val = strtol(level, &ptr, 10);
+	if (errno || ptr == level || val < 0 || val > LEVEL_MAX)
+		return NULL;
+	mapping->level = val;
+
+	if (*ptr != '/')
+		return label;
+	do {
+		errno = 0;
+		val = strtol(ptr + 1, &ptr, 10);
+		if (errno || val <= 0 || val > CAT_MAX_COUNT)
+			return NULL;
+		if (!BITTEST(mapping->cats, val - 1)) {
+			BITSET(mapping->cats, val - 1);
+			mapping->ncats++;
+		}
+	} while (*ptr == ',');
+
+	return label;
+}
+
+int smack_cipso_apply_changes(struct smack_cipso *cipso, int *changed,
+			      int *unchanged)
+{
+	struct cipso_mapping current;
+	struct cipso_mapping *m;
+	uint8_t *skip = NULL;
+	FILE *file = NULL;
+	char *buf = NULL;
+	size_t buf_size = 0;
+	char *label;
+	int same = 0;
+	int use_long;
+	int ret;
+	int fd;
+	int i;
+
+	if (init_smackfs_mnt())
+		return -1;
+
+	skip = calloc(cipso->mappings_cnt + 1, 1);
+	if (skip == NULL)
+		return -1;
+
+	/* without the current mappings, all are written */
+	fd = open_smackfs_file("cipso2", "cipso", O_RDONLY, &use_long);
+	if (fd >= 0) {
+		file = fdopen(fd, "r");
+		if (file == NULL)
+			close(fd);
+	}
+
+	while (file != NULL && getline(&buf, &buf_size, file) >= 0) {
+		label = cipso_parse_kernel(buf, &current);
+		if (label == NULL)
+			continue;
+		i = cipso_find(cipso, label);
+		if (i < 0 || skip[i])
+			continue;
+		m = &cipso->mappings[i];
+		if (m->level == current.level &&
+		    !memcmp(m->cats, current.cats, sizeof(m->cats))) {
+			skip[i] = 1;
+			same++;
+		}
+	}
+
+	if (file != NULL)
+		fclose(file);
+	free(buf);
+
+	ret = cipso_write(cipso, skip);
+	free(skip);
+	if (ret)
+		return -1;
+
+	if (changed)
+		*changed = cipso->mappings_cnt - same;
+	if (unchanged)
+		*unchanged = same;
+	return 0;
+}
+
+int smack_cipso_add_from_file(struct smack_cipso *cipso, int fd)
+{
+	struct cipso_mapping mapping;
+	FILE *file = NULL;
+	char *buf = NULL;
+	size_t buf_size = 0;
+	char *label, *level, *cat, *ptr;
+	long int val;
+	int i;
+	int newfd;
+
+	newfd = dup(fd);
+	if (newfd == -1)
+		return -1;
+
+	file = fdopen(newfd, "r");
+	if (file == NULL) {
+		close(newfd);
+		return -1;
+	}
+
+	while (getline(&buf, &buf_size, file) >= 0) {
+		memset(&mapping, 0, sizeof(mapping));
+
+		label = strtok_r(buf, " \t\n", &ptr);
+		level = strtok_r(NULL, " \t\n", &ptr);
+		cat = strtok_r(NULL, " \t\n", &ptr);
+
+		if (level == NULL)
+			goto err_out;
+
+		val = get_label(NULL, label, &mapping.hash);
+		if (val < 0)
+			goto err_out;
+		if (val > SHORT_LABEL_LEN)
+			cipso->has_long = 1;
+		mapping.label = label;
+
+		errno = 0;
+		val = strtol(level, NULL, 10);
+		if (errno)
+			goto err_out;
+
+		if (val < 0 || val > LEVEL_MAX)
+			goto err_out;
+
+		mapping.level = val;
+
+		for (i = 0; i < CAT_MAX_COUNT && cat != NULL; i++) {
+			errno = 0;
+			val = strtol(cat, NULL, 10);
+			if (errno)
+				goto err_out;
+
+			if (val <= 0 || val > CAT_MAX_COUNT)
+				goto err_out;
+
+			if (!BITTEST(mapping.cats, val - 1)) {
+				BITSET(mapping.cats, val - 1);
+				++(mapping.ncats);
+			}
+
+			cat = strtok_r(NULL, " \t\n", &ptr);
+		}
+
+		/* a later definition of a label replaces the earlier one */
+		if (cipso_add(cipso, &mapping))
+			goto err_out;
+	}
+
+	if (ferror(file))
+		goto err_out;
+
+	fclose(file);
+	free(buf);
+	return 0;
+err_out:
+	fclose(file);
+	free(buf);
+	return -1;
+}
+
+static unsigned int cipso_tuple_hash(int level, const uint8_t *cats)
+{
+	uint64_t words[3] = { 0, 0, 0 };
+	uint64_t hash = level;
+	int i;
+
+	memcpy(words, cats, BITNSLOTS(CAT_MAX_COUNT));
+	for (i = 0; i < 3; i++) {
+		hash = (hash ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+	return hash ^ (hash >> 32);
+}
+
+int smack_cipso_index_new(struct smack_cipso_index **index,
+			  const struct smack_cipso *cipso)
+{
+	struct smack_cipso_index *result;
+	const struct cipso_mapping *other;
+	struct cipso_mapping *m;
+	unsigned int size = 16;
+	unsigned int j;
+	int i;
+
+	result = calloc(1, sizeof(struct smack_cipso_index));
+	if (result == NULL)
+		return -1;
+
+	while (size < 2 * (unsigned int)cipso->mappings_cnt)
+		size *= 2;
+	result->mask = size - 1;
+	result->mappings = malloc((cipso->mappings_cnt + 1) *
+				  sizeof(struct cipso_mapping));
+	result->by_label = calloc(size, sizeof(int));
+	result->by_tuple = calloc(size, sizeof(int));
+	if (result->mappings == NULL || result->by_label == NULL ||
+	    result->by_tuple == NULL) {
+		smack_cipso_index_free(result);
+		return -1;
+	}
+
+	memcpy(result->mappings, cipso->mappings,
+	       cipso->mappings_cnt * sizeof(struct cipso_mapping));
+	result->mappings_cnt = cipso->mappings_cnt;
+
+	for (i = 0; i < result->mappings_cnt; i++) {
+		m = &result->mappings[i];
+
+		/* the index outlives the handle it is built from */
+		m->label = label_copy(&result->label_chunks, m->label,
+				      strlen(m->label));
+		if (m->label == NULL) {
+			smack_cipso_index_free(result);
+			return -1;
+		}
+
+		/* labels are unique in a struct smack_cipso */
+		for (j = m->hash & result->mask; result->by_label[j];
+		     j = (j + 1) & result->mask)
+			;
+		result->by_label[j] = i + 1;
+
+		/* the first label of a tuple is kept */
+		for (j = cipso_tuple_hash(m->level, m->cats) & result->mask;
+		     result->by_tuple[j]; j = (j + 1) & result->mask) {
+			other = &result->mappings[result->by_tuple[j] - 1];
+			if (other->level == m->level &&
+			    !memcmp(other->cats, m->cats, sizeof(m->cats)))
+				break;
+		}
+		if (!result->by_tuple[j])
+			result->by_tuple[j] = i + 1;
+	}
+
+	*index = result;
+	return 0;
+}
+
+void smack_cipso_index_free(struct smack_cipso_index *index)
+{
+	if (index == NULL)
+		return;
+
+	label_chunks_free(index->label_chunks);
+	free(index->mappings);
+	free(index->by_label);
+	free(index->by_tuple);
+	free(index);
+}
+
+int smack_cipso_index_get_tuple(const struct smack_cipso_index *index,
+				const char *label,
+				struct smack_cipso_tuple *tuple)
+{
+	const struct cipso_mapping *m;
+	unsigned int hash;
+	unsigned int i;
+
+	if (get_label(NULL, label, &hash) < 0)
+		return -1;
+
+	for (i = hash & index->mask; index->by_label[i];
+	     i = (i + 1) & index->mask) {
+		m = &index->mappings[index->by_label[i] - 1];
+		if (m->hash == hash && !strcmp(m->label, label)) {
+			tuple->level = m->level;
+			memcpy(tuple->cats, m->cats, sizeof(tuple->cats));
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+const char *smack_cipso_index_get_label(const struct smack_cipso_index *index,
+					const struct smack_cipso_tuple *tuple)
+{
+	const struct cipso_mapping *m;
+	unsigned int i;
+
+	if (tuple->level < 0 || tuple->level > LEVEL_MAX)
+		return NULL;
+
+	for (i = cipso_tuple_hash(tuple->level, tuple->cats) & index->mask;
+	     index->by_tuple[i]; i = (i + 1) & index->mask) {
+		m = &index->mappings[index->by_tuple[i] - 1];
+		if (m->level == tuple->level &&
+		    !memcmp(m->cats, tuple->cats, sizeof(m->cats)))
+			return m->label;
+	}
+
+	return NULL;
+}
+
+const char *smack_smackfs_path(void)
+{
+	if (init_smackfs_mnt())
+		return NULL;
+	return smackfs_mnt;
+}
+
+static inline ssize_t new_label(const char *buf, ssize_t len, char **label)
+{
+	char *result;
+
+	if (len < 0)
+		return -1;
+
+	result = malloc(len + 1);
+	if (result == NULL)
+		return -1;
+
+	memcpy(result, buf, len + 1);
 	*label = result;
+	return len;
+}
+
+static ssize_t proc_label(const char *proc_path, char *label)
+{
+	int fd;
+	int ret;
+
+	fd = open(proc_path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = read(fd, label, SMACK_LABEL_LEN + 1);
+	close(fd);
+
+	return label_from_value(label, ret);
+}
+
+ssize_t smack_get_label_from_self(char *label)
+{
+	return proc_label(SELF_LABEL_FILE, label);
+}
+
+/* Label of the calling thread. A task can only change its own label, so
+ * the copy goes stale only if the thread writes its label behind the back
+ * of smack_set_label_for_self(). */
+static __thread struct {
+	ssize_t len;
+	char label[SMACK_LABEL_LEN + 1];
+} self_label;
+
+ssize_t smack_refresh_label_from_self(void)
+{
+	ssize_t ret;
+
+	ret = proc_label(THREAD_LABEL_FILE, self_label.label);
+	if (ret < 0 && errno == ENOENT)
+		ret = proc_label(SELF_LABEL_FILE, self_label.label);
+
+	self_label.len = ret > 0 ? ret : 0;
 	return ret;
 }
 
-ssize_t smack_new_label_from_self(char **label)
-{
-	return smack_new_label_from_proc(SELF_LABEL_FILE, label);
+ssize_t smack_cached_label_from_self(const char **label)
+{
+	ssize_t ret = self_label.len;
+
+	if (ret == 0) {
+		ret = smack_refresh_label_from_self();
+		if (ret < 0)
+			return -1;
+	}
+
+	*label = self_label.label;
+	return ret;
 }
 
-ssize_t smack_new_label_from_process(pid_t pid, char **label)
+ssize_t smack_get_label_from_process(pid_t pid, char *label)
 {
 	char path[sizeof(PID_LABEL_FILE) + 20];
 	int ret;
@@ -648,91 +1839,104 @@ ssize_t smack_new_label_from_process(pid_t pid, char **label)
 	ret = snprintf(path, sizeof(path), PID_LABEL_FILE, pid);
 	if (ret < 0 || ret >= (int) sizeof(path))
 		return -1;
-	return smack_new_label_from_proc(path, label);
+	return proc_label(path, label);
 }
 
-ssize_t smack_new_label_from_socket(int fd, char **label)
+ssize_t smack_get_label_from_socket(int fd, char *label)
 {
-	char buf[SMACK_LABEL_LEN + 2];
-	int ret;
 	socklen_t length = SMACK_LABEL_LEN + 1;
-	char *result;
 
-	/* If getsockopt return more then SMACK_LABEL_LEN the
-	 * buf does not contain proper smack label and get_label
-	 * will return error. */
-	ret = getsockopt(fd, SOL_SOCKET, SO_PEERSEC, buf, &length);
-	if (ret < 0)
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERSEC, label, &length) < 0)
 		return -1;
 
-	buf[length] = '\0';
+	return label_from_value(label, length);
+}
 
-	result = calloc(length + 1, 1);
-	if (result == NULL)
-		return -1;
+ssize_t smack_get_label_from_path(const char *path, const char *xattr,
+				  int follow, char *label)
+{
+	ssize_t ret;
 
-	ret = get_label(result, buf, NULL);
-	if (ret < 0) {
-		free(result);
-		return -1;
-	}
+	ret = follow ?
+		getxattr(path, xattr, label, SMACK_LABEL_LEN + 1) :
+		lgetxattr(path, xattr, label, SMACK_LABEL_LEN + 1);
 
-	*label = result;
-	return ret;
+	return label_from_value(label, ret);
 }
 
-ssize_t smack_new_label_from_path(const char *path, const char *xattr, 
-				  int follow, char **label)
+ssize_t smack_get_label_from_file(int fd, const char *xattr, char *label)
+{
+	return label_from_value(label,
+				fgetxattr(fd, xattr, label, SMACK_LABEL_LEN + 1));
+}
+
+ssize_t smack_new_label_from_self(char **label)
 {
 	char buf[SMACK_LABEL_LEN + 1];
-	char *result;
-	ssize_t ret = 0;
 
-	ret = follow ?
-		getxattr(path, xattr, buf, SMACK_LABEL_LEN + 1) :
-		lgetxattr(path, xattr, buf, SMACK_LABEL_LEN + 1);
-	if (ret < 0)
-		return -1;
-	buf[ret] = '\0';
+	return new_label(buf, smack_get_label_from_self(buf), label);
+}
 
-	result = calloc(ret + 1, 1);
-	if (result == NULL)
-		return -1;
+ssize_t smack_new_label_from_process(pid_t pid, char **label)
+{
+	char buf[SMACK_LABEL_LEN + 1];
 
-	ret = get_label(result, buf, NULL);
-	if (ret < 0) {
-		free(result);
-		return -1;
-	}
+	return new_label(buf, smack_get_label_from_process(pid, buf), label);
+}
 
-	*label = result;
-	return ret;
+ssize_t smack_new_label_from_socket(int fd, char **label)
+{
+	char buf[SMACK_LABEL_LEN + 1];
+
+	return new_label(buf, smack_get_label_from_socket(fd, buf), label);
 }
 
-ssize_t smack_new_label_from_file(int fd, const char *xattr, 
-				  char **label)
+int smack_have_access_from_socket_label(int fd, const char *object,
+					const char *access_type, char *label)
 {
 	char buf[SMACK_LABEL_LEN + 1];
-	char *result;
-	ssize_t ret = 0;
+	ssize_t slen;
+	ssize_t olen;
 
-	ret = fgetxattr(fd, xattr, buf, SMACK_LABEL_LEN + 1);
-	if (ret < 0)
+	if (init_smackfs_mnt())
 		return -1;
-	buf[ret] = '\0';
 
-	result = calloc(ret + 1, 1);
-	if (result == NULL)
+	olen = get_label(NULL, object, NULL);
+	if (olen < 0)
 		return -1;
 
-	ret = get_label(result, buf, NULL);
-	if (ret < 0) {
-		free(result);
+	slen = smack_get_label_from_socket(fd, buf);
+	if (slen < 0)
 		return -1;
-	}
 
-	*label = result;
-	return ret;
+	if (label)
+		memcpy(label, buf, slen + 1);
+
+	return have_access(buf, slen, object, olen, access_type);
+}
+
+int smack_have_access_from_socket(int fd, const char *object,
+				  const char *access_type)
+{
+	return smack_have_access_from_socket_label(fd, object, access_type,
+						   NULL);
+}
+
+ssize_t smack_new_label_from_path(const char *path, const char *xattr,
+				  int follow, char **label)
+{
+	char buf[SMACK_LABEL_LEN + 1];
+
+	return new_label(buf,
+			 smack_get_label_from_path(path, xattr, follow, buf),
+			 label);
+}
+
+ssize_t smack_new_label_from_file(int fd, const char *xattr, char **label)
+{
+	char buf[SMACK_LABEL_LEN + 1];
+
+	return new_label(buf, smack_get_label_from_file(fd, xattr, buf), label);
 }
 
 int smack_set_label_for_path(const char *path,
@@ -776,6 +1980,460 @@ int smack_remove_label_for_file(int fd, const char *xattr)
 	return fremovexattr(fd, xattr);
 }
 
+/* The *xattrat() syscalls of Linux 6.13 take a directory descriptor, a
+ * path and AT_* flags. Their numbers are the same on the architectures
+ * sharing the generic syscall table. */
+#if !defined(__NR_getxattrat) && \
+	((defined(__x86_64__) && !defined(__ILP32__)) || defined(__i386__) || \
+	 defined(__aarch64__) || defined(__arm__) || defined(__riscv) || \
+	 defined(__powerpc__) || defined(__s390__) || defined(__loongarch__))
+#define __NR_setxattrat 463
+#define __NR_getxattrat 464
+#define __NR_listxattrat 465
+#define __NR_removexattrat 466
+#endif
+
+/* struct xattr_args of linux/xattr.h, which older headers lack */
+struct xattrat_args {
+	uint64_t value;
+	uint32_t size;
+	uint32_t flags;
+};
+
+/* Where the xattr syscalls of a *_at() function are carried out: a
+ * directory descriptor and a path for the *xattrat() syscalls, an open
+ * descriptor of a regular file or directory, or else a path for the path
+ * based syscalls. Opening symlinks is not possible and opening devices,
+ * fifos or sockets may have side effects, these go by path. */
+struct xattr_target {
+	int fd;
+	int close;
+	int follow;
+	int at;
+	const char *path;
+};
+
+#ifdef __NR_getxattrat
+static ssize_t target_xattrat(const struct xattr_target *target,
+			      enum xattr_op op, const char *name,
+			      void *value, size_t size)
+{
+	struct xattrat_args args = {
+		.value = (uintptr_t)value,
+		.size = size,
+	};
+	unsigned int flags = target->follow ? 0 : AT_SYMLINK_NOFOLLOW;
+
+	switch (op) {
+	case XATTR_OP_GET:
+		return syscall(__NR_getxattrat, target->fd, target->path,
+			       flags, name, &args, sizeof(args));
+	case XATTR_OP_SET:
+		return syscall(__NR_setxattrat, target->fd, target->path,
+			       flags, name, &args, sizeof(args));
+	case XATTR_OP_REMOVE:
+		return syscall(__NR_removexattrat, target->fd, target->path,
+			       flags, name);
+	default:
+		return syscall(__NR_listxattrat, target->fd, target->path,
+			       flags, value, size);
+	}
+}
+
+/* 1 if the *xattrat() syscalls are available, -1 if not, 0 until known */
+static int xattrat_state;
+
+static int have_xattrat(void)
+{
+	int state = __atomic_load_n(&xattrat_state, __ATOMIC_RELAXED);
+	int saved_errno;
+
+	if (state)
+		return state > 0;
+
+	/* A call with a too small argument structure fails with EINVAL
+	 * before anything is looked up. Older kernels, and seccomp filters
+	 * not knowing the syscall, fail with another error. */
+	saved_errno = errno;
+	state = syscall(__NR_getxattrat, -1, "", AT_EMPTY_PATH, "", NULL, 0)
+		< 0 && errno == EINVAL ? 1 : -1;
+	errno = saved_errno;
+	__atomic_store_n(&xattrat_state, state, __ATOMIC_RELAXED);
+	return state > 0;
+}
+#else
+static inline ssize_t target_xattrat(const struct xattr_target *target,
+				     enum xattr_op op, const char *name,
+				     void *value, size_t size)
+{
+	(void)target;
+	(void)op;
+	(void)name;
+	(void)value;
+	(void)size;
+	errno = ENOSYS;
+	return -1;
+}
+
+static inline int have_xattrat(void)
+{
+	return 0;
+}
+#endif
+
+static ssize_t target_xattr(const struct xattr_target *target,
+			    enum xattr_op op, const char *name,
+			    void *value, size_t size)
+{
+	const char *path = target->path;
+
+	if (target->at)
+		return target_xattrat(target, op, name, value, size);
+
+	if (path == NULL) {
+		switch (op) {
+		case XATTR_OP_GET:
+			return fgetxattr(target->fd, name, value, size);
+		case XATTR_OP_SET:
+			return fsetxattr(target->fd, name, value, size, 0);
+		case XATTR_OP_REMOVE:
+			return fremovexattr(target->fd, name);
+		default:
+			return flistxattr(target->fd, value, size);
+		}
+	}
+
+	switch (op) {
+	case XATTR_OP_GET:
+		return target->follow ? getxattr(path, name, value, size) :
+					lgetxattr(path, name, value, size);
+	case XATTR_OP_SET:
+		return target->follow ? setxattr(path, name, value, size, 0) :
+					lsetxattr(path, name, value, size, 0);
+	case XATTR_OP_REMOVE:
+		return target->follow ? removexattr(path, name) :
+					lremovexattr(path, name);
+	default:
+		return target->follow ? listxattr(path, value, size) :
+					llistxattr(path, value, size);
+	}
+}
+
+static int target_path(struct xattr_target *target, int dirfd,
+		       const char *path, char *buf)
+{
+	int len;
+
+	target->fd = -1;
+	target->close = 0;
+	target->at = 0;
+	if (dirfd == AT_FDCWD || path[0] == '/') {
+		target->path = path;
+		return 0;
+	}
+
+	/* The path based syscalls have no dirfd, the descriptor is reached
+	 * through its procfs link. */
+	len = snprintf(buf, SELF_FD_PATH_LEN, SELF_FD_PATH, dirfd, path);
+	if (len >= (int)SELF_FD_PATH_LEN) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	target->path = buf;
+	return 0;
+}
+
+static int target_open(struct xattr_target *target, int dirfd,
+		       const char *path, int flags, char *buf)
+{
+	unsigned char type = (flags & SMACK_AT_DTYPE(0xf)) >> 24;
+	struct stat st;
+
+	target->follow = !(flags & AT_SYMLINK_NOFOLLOW);
+	target->close = 0;
+	target->at = 0;
+	target->path = NULL;
+	target->fd = -1;
+
+	if ((flags & AT_EMPTY_PATH) && path[0] == '\0') {
+		target->fd = dirfd;
+		return 0;
+	}
+
+	/* With no dirfd involved the path based syscalls need a single
+	 * lookup, cheaper than a stat, an open and a close. */
+	if (dirfd == AT_FDCWD || path[0] == '/')
+		return target_path(target, dirfd, path, buf);
+
+	if (have_xattrat()) {
+		target->fd = dirfd;
+		target->path = path;
+		target->at = 1;
+		return 0;
+	}
+
+	/* The type given with SMACK_AT_DTYPE() saves the stat, unless it is
+	 * a link that is followed. */
+	if (type == DT_UNKNOWN || (type == DT_LNK && target->follow)) {
+		if (fstatat(dirfd, path, &st, flags & AT_SYMLINK_NOFOLLOW) < 0)
+			return -1;
+		type = IFTODT(st.st_mode);
+	}
+	if (type != DT_REG && type != DT_DIR)
+		return target_path(target, dirfd, path, buf);
+
+	target->fd = openat(dirfd, path, O_RDONLY | O_NONBLOCK | O_CLOEXEC |
+			    (target->follow ? 0 : O_NOFOLLOW));
+	if (target->fd >= 0) {
+		target->close = 1;
+		return 0;
+	}
+
+	/* Replaced by a symlink since the stat, or not readable. */
+	if (errno == ELOOP || errno == EACCES || errno == EPERM)
+		return target_path(target, dirfd, path, buf);
+	return -1;
+}
+
+static void target_close(struct xattr_target *target)
+{
+	int saved_errno;
+
+	if (!target->close)
+		return;
+
+	saved_errno = errno;
+	close(target->fd);
+	errno = saved_errno;
+}
+
+static ssize_t xattr_at(int dirfd, const char *path, int flags,
+			enum xattr_op op, const char *name,
+			void *value, size_t size)
+{
+	struct xattr_target target;
+	char buf[SELF_FD_PATH_LEN];
+	ssize_t ret;
+
+	if (target_open(&target, dirfd, path, flags, buf))
+		return -1;
+
+	ret = target_xattr(&target, op, name, value, size);
+	target_close(&target);
+	return ret;
+}
+
+ssize_t smack_get_label_from_path_at(int dirfd, const char *path,
+				     const char *xattr, int flags,
+				     char *label)
+{
+	return label_from_value(label,
+				xattr_at(dirfd, path, flags, XATTR_OP_GET,
+					 xattr, label, SMACK_LABEL_LEN + 1));
+}
+
+ssize_t smack_new_label_from_path_at(int dirfd, const char *path,
+				     const char *xattr, int flags,
+				     char **label)
+{
+	char buf[SMACK_LABEL_LEN + 1];
+
+	return new_label(buf,
+			 smack_get_label_from_path_at(dirfd, path, xattr,
+						      flags, buf),
+			 label);
+}
+
+int smack_set_label_for_path_at(int dirfd, const char *path,
+				const char *xattr, int flags,
+				const char *label)
+{
+	int len;
+
+	len = (int)smack_label_length(label);
+	if (len < 0)
+		return -2;
+
+	return xattr_at(dirfd, path, flags, XATTR_OP_SET, xattr,
+			(void *)label, len);
+}
+
+int smack_remove_label_for_path_at(int dirfd, const char *path,
+				   const char *xattr, int flags)
+{
+	return xattr_at(dirfd, path, flags, XATTR_OP_REMOVE, xattr, NULL, 0);
+}
+
+/* Write the label only when the attribute holds a different value, an
+ * unchanged inode is not dirtied. Returns 1 if the label was written. */
+static int update_label(const struct xattr_target *target, const char *xattr,
+			const char *label)
+{
+	char buf[SMACK_LABEL_LEN + 1];
+	ssize_t cur;
+	int len;
+
+	len = (int)smack_label_length(label);
+	if (len < 0)
+		return -2;
+
+	cur = target_xattr(target, XATTR_OP_GET, xattr, buf, sizeof(buf));
+	if (cur < 0 && errno != ENODATA && errno != ERANGE)
+		return -1;
+
+	if ((cur == len || (cur == len + 1 && buf[len] == '\0')) &&
+	    !memcmp(buf, label, len))
+		return 0;
+
+	if (target_xattr(target, XATTR_OP_SET, xattr, (void *)label, len) < 0)
+		return -1;
+	return 1;
+}
+
+int smack_update_label_for_file(int fd, const char *xattr,
+				const char *label)
+{
+	struct xattr_target target = {.fd = fd};
+
+	return update_label(&target, xattr, label);
+}
+
+int smack_update_label_for_path_at(int dirfd, const char *path,
+				   const char *xattr, int flags,
+				   const char *label)
+{
+	struct xattr_target target;
+	char buf[SELF_FD_PATH_LEN];
+	int ret;
+
+	if (target_open(&target, dirfd, path, flags, buf))
+		return -1;
+
+	ret = update_label(&target, xattr, label);
+	target_close(&target);
+	return ret;
+}
+
+int smack_update_label_for_path(const char *path, const char *xattr,
+				int follow, const char *label)
+{
+	return smack_update_label_for_path_at(AT_FDCWD, path, xattr,
+					      follow ? 0 : AT_SYMLINK_NOFOLLOW,
+					      label);
+}
+
+static char *file_label_buffer(struct smack_file_labels *labels,
+			       const char *name)
+{
+	if (strncmp(name, XATTR_SECURITY_PREFIX,
+		    XATTR_SECURITY_PREFIX_LEN) != 0)
+		return NULL;
+
+	name += XATTR_SECURITY_PREFIX_LEN;
+	if (!strcmp(name, XATTR_SMACK_SUFFIX))
+		return labels->access;
+	if (!strcmp(name, XATTR_SMACK_EXEC))
+		return labels->exec;
+	if (!strcmp(name, XATTR_SMACK_MMAP))
+		return labels->mmap;
+	if (!strcmp(name, XATTR_SMACK_TRANSMUTE))
+		return labels->transmute;
+	return NULL;
+}
+
+static int get_file_labels(const struct xattr_target *target,
+			   struct smack_file_labels *labels)
+{
+	char stack_list[XATTR_LIST_LEN];
+	char *list = stack_list;
+	char *name;
+	char *label;
+	ssize_t size;
+	ssize_t len;
+	int count = 0;
+
+	labels->access[0] = '\0';
+	labels->exec[0] = '\0';
+	labels->mmap[0] = '\0';
+	labels->transmute[0] = '\0';
+
+	size = target_xattr(target, XATTR_OP_LIST, NULL, list,
+			    sizeof(stack_list));
+	while (size < 0 && errno == ERANGE) {
+		if (list != stack_list)
+			free(list);
+		size = target_xattr(target, XATTR_OP_LIST, NULL, NULL, 0);
+		if (size < 0)
+			return -1;
+		list = malloc(size + 1);
+		if (list == NULL)
+			return -1;
+		size = target_xattr(target, XATTR_OP_LIST, NULL, list,
+				    size + 1);
+	}
+	if (size < 0) {
+		if (list != stack_list)
+			free(list);
+		if (errno == ENOTSUP)
+			return 0;
+		return -1;
+	}
+
+	for (name = list; name < list + size; name += strlen(name) + 1) {
+		label = file_label_buffer(labels, name);
+		if (label == NULL)
+			continue;
+
+		/* An attribute removed since the list is absent, any other
+		 * failure to read it is an error. */
+		len = target_xattr(target, XATTR_OP_GET, name, label,
+				   SMACK_LABEL_LEN + 1);
+		if (len < 0 && errno != ENODATA) {
+			count = -1;
+			break;
+		}
+
+		if (label_from_value(label, len) > 0)
+			count++;
+		else
+			label[0] = '\0';
+	}
+
+	if (list != stack_list)
+		free(list);
+	return count;
+}
+
+int smack_get_file_labels(int fd, struct smack_file_labels *labels)
+{
+	struct xattr_target target = {.fd = fd};
+
+	return get_file_labels(&target, labels);
+}
+
+int smack_get_file_labels_at(int dirfd, const char *path, int flags,
+			     struct smack_file_labels *labels)
+{
+	struct xattr_target target;
+	char buf[SELF_FD_PATH_LEN];
+	int ret;
+
+	if (target_open(&target, dirfd, path, flags, buf))
+		return -1;
+
+	ret = get_file_labels(&target, labels);
+	target_close(&target);
+	return ret;
+}
+
+int smack_get_path_labels(const char *path, int follow,
+			  struct smack_file_labels *labels)
+{
+	return smack_get_file_labels_at(AT_FDCWD, path,
+					follow ? 0 : AT_SYMLINK_NOFOLLOW,
+					labels);
+}
+
 int smack_set_label_for_self(const char *label)
 {
 	int len;
@@ -792,8 +2450,13 @@ int smack_set_label_for_self(const char *label)
 
 	ret = write(fd, label, len);
 	close(fd);
+	if (ret < 0)
+		return -1;
 
-	return (ret < 0) ? -1 : 0;
+	memcpy(self_label.label, label, len);
+	self_label.label[len] = '\0';
+	self_label.len = len;
+	return 0;
 }
 
 int smack_revoke_subject(const char *subject)
@@ -976,6 +2639,36 @@ static inline int rule_print_short(struct smack_file_buffer *buffer,
 	return 0;
 }
 
+/* Merge all rules of the given subject into handle->merge_perms, indexed
+ * by object id. Ids of the objects touched are stored in
+ * handle->merge_object_ids and their count is returned. The caller must
+ * reset merge_perms entries of the returned objects after use. */
+static int accesses_merge(struct smack_accesses *handle,
+			  struct smack_label *subject_label, int clear)
+{
+	struct smack_rule *rule;
+	union smack_perm *perm;
+	int merge_cnt = 0;
+
+	for (rule = subject_label->first_rule; rule != NULL; rule = rule->next_rule) {
+		perm = &(handle->merge_perms[rule->object_id]);
+		if (perm->allow_deny_code == 0)
+			handle->merge_object_ids[merge_cnt++] = rule->object_id;
+
+		if (clear) {
+			perm->allow_code = 0;
+			perm->deny_code  = ACCESS_TYPE_ALL;
+		} else {
+			perm->allow_code |=  rule->perm.allow_code;
+			perm->allow_code &= ~rule->perm.deny_code;
+			perm->deny_code  &= ~rule->perm.allow_code;
+			perm->deny_code  |=  rule->perm.deny_code;
+		}
+	}
+
+	return merge_cnt;
+}
+
 static int accesses_print(struct smack_accesses *handle, int clear,
 			  int use_long, int multiline,
 			  struct smack_file_buffer *load_buffer,
@@ -986,7 +2679,6 @@ static int accesses_print(struct smack_accesses *handle, int clear,
 	char deny_str[ACC_LEN + 1];
 	struct smack_label *subject_label;
 	struct smack_label *object_label;
-	struct smack_rule *rule;
 	union smack_perm *perm;
 	int merge_cnt;
 	int x;
@@ -1000,22 +2692,7 @@ static int accesses_print(struct smack_accesses *handle, int clear,
 	bzero(handle->merge_perms, handle->labels_cnt * sizeof(union smack_perm));
 	for (x = 0; x < handle->labels_cnt; ++x) {
 		subject_label = handle->labels[x];
-		merge_cnt = 0;
-		for (rule = subject_label->first_rule; rule != NULL; rule = rule->next_rule) {
-			perm = &(handle->merge_perms[rule->object_id]);
-			if (perm->allow_deny_code == 0)
-				handle->merge_object_ids[merge_cnt++] = rule->object_id;
-
-			if (clear) {
-				perm->allow_code = 0;
-				perm->deny_code  = ACCESS_TYPE_ALL;
-			} else {
-				perm->allow_code |=  rule->perm.allow_code;
-				perm->allow_code &= ~rule->perm.deny_code;
-				perm->deny_code  &= ~rule->perm.allow_code;
-				perm->deny_code  |=  rule->perm.deny_code;
-			}
-		}
+		merge_cnt = accesses_merge(handle, subject_label, clear);
 
 		for (y = 0; y < merge_cnt; ++y) {
 			int ret = 0;
@@ -1111,7 +2788,7 @@ static inline ssize_t get_label(char *dest, const char *src, unsigned int *hash)
 	if (dest && i < (SMACK_LABEL_LEN + 1))
 		dest[i] = '\0';
 	if (hash)
-		*hash = h % DICT_HASH_SIZE;
+		*hash = h;
 
 	return i < (SMACK_LABEL_LEN + 1) ? i : -1;
 }
@@ -1204,6 +2881,39 @@ static inline int accesses_resize(struct smack_accesses *handle)
 	return 0;
 }
 
+static const char *label_copy(struct label_chunk **chunks, const char *label,
+			      int len)
+{
+	struct label_chunk *chunk = *chunks;
+	char *result;
+
+	if (chunk == NULL || chunk->used + len + 1 > LABEL_CHUNK_SIZE) {
+		chunk = malloc(sizeof(struct label_chunk));
+		if (chunk == NULL)
+			return NULL;
+		chunk->next = *chunks;
+		chunk->used = 0;
+		*chunks = chunk;
+	}
+
+	result = chunk->data + chunk->used;
+	memcpy(result, label, len);
+	result[len] = '\0';
+	chunk->used += len + 1;
+	return result;
+}
+
+static void label_chunks_free(struct label_chunk *chunk)
+{
+	struct label_chunk *next;
+
+	while (chunk != NULL) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
 static struct smack_label *label_add(struct smack_accesses *handle, const char *label)
 {
 	struct smack_hash_entry *hash_entry;
@@ -1214,6 +2924,7 @@ static struct smack_label *label_add(struct smack_accesses *handle, const char *
 	len = get_label(NULL, label, &hash_value);
 	if (len == -1)
 		return NULL;
+	hash_value %= DICT_HASH_SIZE;
 
 	new_label = is_label_known(handle, label, hash_value);
 	if (new_label == NULL) {/*no entry added yet*/
@@ -1224,13 +2935,13 @@ static struct smack_label *label_add(struct smack_accesses *handle, const char *
 		new_label = malloc(sizeof(struct smack_label));
 		if (new_label == NULL)
 			return NULL;
-		new_label->label = malloc(len + 1);
+		new_label->label = label_copy(&handle->label_chunks, label,
+					      len);
 		if (new_label->label == NULL) {
 			free(new_label);
 			return NULL;
 		}
 
-		memcpy(new_label->label, label, len + 1);
 		new_label->id = handle->labels_cnt;
 		new_label->len = len;
 		new_label->first_rule = NULL;
@@ -1263,7 +2974,7 @@ int smack_load_policy(void)
 	if (apply_rules(ACCESSES_D_PATH, 0))
 		return -1;
 
-	if (apply_cipso(CIPSO_D_PATH))
+	if (apply_cipso(CIPSO_D_PATH, NULL, NULL))
 		return -1;
 
 
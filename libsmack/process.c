@@ -0,0 +1,445 @@
+/*
+ * This file is part of libsmack
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "sys/smack.h"
+#include "common.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define PROC_PATH "/proc"
+#define PID_STAT_FILE "%d/stat"
+#define PID_ATTR_FILE "%d/attr/current"
+#define PID_PATH_LEN 32
+#define STAT_BUF_LEN 1024
+#define STAT_STARTTIME_FIELD 22
+
+struct process_entry {
+	pid_t pid;
+	unsigned long long starttime;
+	ino_t ino;
+	struct timespec ctime;
+	int len;
+	char label[SMACK_LABEL_LEN + 1];
+};
+
+struct process_walk {
+	int proc_fd;
+	pid_t *pids;
+	int pids_cnt;
+	int next;
+	int stop;
+	int found;
+	smack_process_fn fn;
+	void *data;
+};
+
+struct smack_process_cache {
+	int proc_fd;
+	int cnt;
+	int mask;
+	struct process_entry **table;
+};
+
+int smack_process_cache_new(struct smack_process_cache **cache,
+			    const char *proc_path)
+{
+	struct smack_process_cache *result;
+
+	result = calloc(1, sizeof(struct smack_process_cache));
+	if (result == NULL)
+		return -1;
+
+	result->mask = 1023;
+	result->table = calloc(result->mask + 1, sizeof(struct process_entry *));
+	if (result->table == NULL)
+		goto err_out;
+
+	result->proc_fd = open(proc_path ? proc_path : PROC_PATH,
+			       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (result->proc_fd < 0)
+		goto err_out;
+
+	*cache = result;
+	return 0;
+
+err_out:
+	free(result->table);
+	free(result);
+	return -1;
+}
+
+void smack_process_cache_free(struct smack_process_cache *cache)
+{
+	int i;
+
+	if (cache == NULL)
+		return;
+
+	for (i = 0; i <= cache->mask; ++i)
+		free(cache->table[i]);
+	free(cache->table);
+	close(cache->proc_fd);
+	free(cache);
+}
+
+static inline unsigned int pid_hash(pid_t pid)
+{
+	return (unsigned int)pid * 0x9e3779b1u;
+}
+
+static struct process_entry **entry_slot(struct smack_process_cache *cache,
+					 pid_t pid)
+{
+	unsigned int h;
+
+	for (h = pid_hash(pid);; ++h) {
+		struct process_entry **slot = &cache->table[h & cache->mask];
+		if (*slot == NULL || (*slot)->pid == pid)
+			return slot;
+	}
+}
+
+static int cache_grow(struct smack_process_cache *cache)
+{
+	struct process_entry **old = cache->table;
+	int old_mask = cache->mask;
+	int i;
+
+	cache->table = calloc((old_mask + 1) * 2, sizeof(struct process_entry *));
+	if (cache->table == NULL) {
+		cache->table = old;
+		return -1;
+	}
+
+	cache->mask = old_mask * 2 + 1;
+	for (i = 0; i <= old_mask; ++i)
+		if (old[i] != NULL)
+			*entry_slot(cache, old[i]->pid) = old[i];
+
+	free(old);
+	return 0;
+}
+
+static void cache_remove(struct smack_process_cache *cache, pid_t pid)
+{
+	struct process_entry **slot = entry_slot(cache, pid);
+	struct process_entry *entry;
+	unsigned int i;
+	unsigned int j;
+	unsigned int home;
+
+	if (*slot == NULL)
+		return;
+
+	free(*slot);
+	*slot = NULL;
+	--cache->cnt;
+
+	/* Shift back the entries that follow in the same probe sequence so
+	 * that no lookup stops at the hole. */
+	i = slot - cache->table;
+	for (j = (i + 1) & cache->mask; cache->table[j] != NULL;
+	     j = (j + 1) & cache->mask) {
+		entry = cache->table[j];
+		home = pid_hash(entry->pid) & cache->mask;
+		if (((j - home) & cache->mask) >= ((j - i) & cache->mask)) {
+			cache->table[i] = entry;
+			cache->table[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+void smack_process_cache_invalidate(struct smack_process_cache *cache,
+				    pid_t pid)
+{
+	cache_remove(cache, pid);
+}
+
+static int read_at(int dirfd, const char *path, char *buf, size_t size)
+{
+	int fd;
+	int ret;
+
+	fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	ret = read(fd, buf, size);
+	close(fd);
+	return ret;
+}
+
+static int read_starttime(int proc_fd, pid_t pid, unsigned long long *starttime)
+{
+	char path[PID_PATH_LEN];
+	char buf[STAT_BUF_LEN + 1];
+	char *ptr;
+	char *end;
+	int field;
+	int ret;
+
+	snprintf(path, sizeof(path), PID_STAT_FILE, pid);
+	ret = read_at(proc_fd, path, buf, STAT_BUF_LEN);
+	if (ret < 0)
+		return -1;
+	buf[ret] = '\0';
+
+	/* The command name may contain spaces and parentheses, fields are
+	 * counted from the last closing one. */
+	ptr = strrchr(buf, ')');
+	if (ptr == NULL)
+		return -1;
+
+	for (field = 2; field < STAT_STARTTIME_FIELD; ++field) {
+		ptr = strchr(ptr + 1, ' ');
+		if (ptr == NULL)
+			return -1;
+	}
+
+	errno = 0;
+	*starttime = strtoull(ptr + 1, &end, 10);
+	if (errno || end == ptr + 1)
+		return -1;
+
+	return 0;
+}
+
+static ssize_t read_label(int proc_fd, pid_t pid, char *label)
+{
+	char path[PID_PATH_LEN];
+	int ret;
+
+	snprintf(path, sizeof(path), PID_ATTR_FILE, pid);
+	ret = read_at(proc_fd, path, label, SMACK_LABEL_LEN + 1);
+
+	return label_from_value(label, ret);
+}
+
+ssize_t smack_process_cache_get(struct smack_process_cache *cache, pid_t pid,
+				const char **label)
+{
+	struct process_entry **slot;
+	struct process_entry *entry;
+	unsigned long long starttime;
+	char path[PID_PATH_LEN];
+	struct stat st;
+	ssize_t ret;
+
+	if (pid <= 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "%d", pid);
+	if (fstatat(cache->proc_fd, path, &st, 0) < 0) {
+		if (errno == ENOENT)
+			cache_remove(cache, pid);
+		return -1;
+	}
+
+	slot = entry_slot(cache, pid);
+	entry = *slot;
+
+	/* Directory of a pid is a new inode when the pid gets reused, if it
+	 * is unchanged the cached label is still valid. */
+	if (entry != NULL && entry->ino == st.st_ino &&
+	    entry->ctime.tv_sec == st.st_ctim.tv_sec &&
+	    entry->ctime.tv_nsec == st.st_ctim.tv_nsec) {
+		*label = entry->label;
+		return entry->len;
+	}
+
+	if (read_starttime(cache->proc_fd, pid, &starttime))
+		return -1;
+
+	if (entry == NULL) {
+		if (2 * (cache->cnt + 1) > cache->mask + 1) {
+			if (cache_grow(cache))
+				return -1;
+			slot = entry_slot(cache, pid);
+		}
+
+		entry = calloc(1, sizeof(struct process_entry));
+		if (entry == NULL)
+			return -1;
+		entry->pid = pid;
+		*slot = entry;
+		++cache->cnt;
+	} else if (entry->starttime == starttime) {
+		/* Same process, only its /proc inode was recreated. */
+		entry->ino = st.st_ino;
+		entry->ctime = st.st_ctim;
+		*label = entry->label;
+		return entry->len;
+	}
+
+	ret = read_label(cache->proc_fd, pid, entry->label);
+	if (ret < 0) {
+		cache_remove(cache, pid);
+		return -1;
+	}
+
+	entry->len = ret;
+	entry->starttime = starttime;
+	entry->ino = st.st_ino;
+	entry->ctime = st.st_ctim;
+	*label = entry->label;
+	return ret;
+}
+
+int smack_process_cache_get_many(struct smack_process_cache *cache,
+				 const pid_t *pids, const char **labels,
+				 int cnt)
+{
+	int found = 0;
+	int i;
+
+	for (i = 0; i < cnt; ++i) {
+		if (smack_process_cache_get(cache, pids[i], &labels[i]) < 0)
+			labels[i] = NULL;
+		else
+			++found;
+	}
+
+	return found;
+}
+
+static int list_pids(int proc_fd, pid_t **pids)
+{
+	struct dirent *dent;
+	DIR *dir;
+	pid_t *result = NULL;
+	pid_t *tmp;
+	int cnt = 0;
+	int alloc = 0;
+	char *end;
+	long pid;
+	int fd;
+
+	fd = openat(proc_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	while ((dent = readdir(dir)) != NULL) {
+		if (dent->d_type != DT_DIR && dent->d_type != DT_UNKNOWN)
+			continue;
+
+		pid = strtol(dent->d_name, &end, 10);
+		if (*end != '\0' || pid <= 0)
+			continue;
+
+		if (cnt == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(result, alloc * sizeof(pid_t));
+			if (tmp == NULL) {
+				free(result);
+				closedir(dir);
+				return -1;
+			}
+			result = tmp;
+		}
+		result[cnt++] = pid;
+	}
+
+	closedir(dir);
+	*pids = result;
+	return cnt;
+}
+
+static void *walk_pids(void *arg)
+{
+	struct process_walk *walk = arg;
+	char label[SMACK_LABEL_LEN + 1];
+	int found = 0;
+	int i;
+
+	while (!__atomic_load_n(&walk->stop, __ATOMIC_RELAXED)) {
+		i = __atomic_fetch_add(&walk->next, 1, __ATOMIC_RELAXED);
+		if (i >= walk->pids_cnt)
+			break;
+
+		/* Processes may exit while we walk, skip them. */
+		if (read_label(walk->proc_fd, walk->pids[i], label) < 0)
+			continue;
+
+		++found;
+		if (walk->fn(walk->pids[i], label, walk->data))
+			__atomic_store_n(&walk->stop, 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_fetch_add(&walk->found, found, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+int smack_foreach_process_label(const char *proc_path, int threads,
+				smack_process_fn fn, void *data)
+{
+	struct process_walk walk = {.fn = fn, .data = data};
+	pthread_t *tids = NULL;
+	int started = 0;
+	int ret = -1;
+	int i;
+
+	walk.proc_fd = open(proc_path ? proc_path : PROC_PATH,
+			    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (walk.proc_fd < 0)
+		return -1;
+
+	walk.pids_cnt = list_pids(walk.proc_fd, &walk.pids);
+	if (walk.pids_cnt < 0)
+		goto out;
+
+	if (threads > walk.pids_cnt)
+		threads = walk.pids_cnt;
+
+	if (threads > 1) {
+		tids = malloc((threads - 1) * sizeof(pthread_t));
+		if (tids == NULL)
+			goto out;
+		for (; started < threads - 1; ++started)
+			if (pthread_create(&tids[started], NULL, walk_pids, &walk))
+				break;
+	}
+
+	/* The calling thread takes its share of the work too. */
+	walk_pids(&walk);
+
+	for (i = 0; i < started; ++i)
+		pthread_join(tids[i], NULL);
+
+	ret = walk.found;
+out:
+	free(tids);
+	free(walk.pids);
+	close(walk.proc_fd);
+	return ret;
+}
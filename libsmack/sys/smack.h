@@ -44,6 +44,101 @@ struct smack_accesses;
  */
 struct smack_cipso;
 
+/*!
+ * Integer identifier of a label interned into a struct smack_accesses
+ * instance. Identifiers are dense, start from zero and stay valid for the
+ * lifetime of the instance. Labels of an instance are owned by it.
+ */
+typedef int smack_label_id;
+
+/*!
+ * Integer identifier of a label in the process-wide pool of
+ * smack_intern_label_id(). The pool is separate from struct
+ * smack_accesses instances: its identifiers are not smack_label_id values
+ * and can't be passed to functions taking one.
+ */
+typedef int smack_intern_id;
+
+/*!
+ * Handle to a compiled, read-only snapshot of a set of Smack rules that
+ * answers access checks without the kernel.
+ */
+struct smack_policy;
+
+/*!
+ * Handle to a shared slot holding the current struct smack_policy
+ * snapshot. Readers never block, a writer publishes new snapshots.
+ */
+struct smack_shared_policy;
+
+/*!
+ * Handle to a cache of process labels.
+ */
+struct smack_process_cache;
+
+/*!
+ * Smack labels of a file. An attribute that is not set on the file is an
+ * empty string.
+ */
+struct smack_file_labels {
+	char access[SMACK_LABEL_LEN + 1];
+	char exec[SMACK_LABEL_LEN + 1];
+	char mmap[SMACK_LABEL_LEN + 1];
+	char transmute[SMACK_LABEL_LEN + 1];
+};
+
+/*!
+ * Handle to a queue of label operations on files that are carried out
+ * asynchronously, see smack_label_batch_new().
+ */
+struct smack_label_batch;
+
+/*!
+ * Flag of smack_label_batch_new() to use threads instead of io_uring.
+ */
+#define SMACK_BATCH_THREADS 1
+
+/*!
+ * Callback reporting the completion of a queued label operation. The
+ * result is the one of the synchronous function; on failure it is
+ * negative and errno is set. Callbacks run in the thread calling the
+ * batch functions and may queue further operations.
+ */
+typedef void (*smack_batch_fn)(ssize_t result, void *data);
+
+/*!
+ * Highest CIPSO category number.
+ */
+#define SMACK_CIPSO_CAT_MAX 184
+
+/*!
+ * CIPSO level and categories of a label. Category c, from 1 to
+ * SMACK_CIPSO_CAT_MAX, is set if bit (c - 1) % 8 of cats[(c - 1) / 8] is.
+ */
+struct smack_cipso_tuple {
+	int level;
+	unsigned char cats[(SMACK_CIPSO_CAT_MAX + 7) / 8];
+};
+
+/*!
+ * Handle to a read-only index of CIPSO mappings, looked up by label and
+ * by level and categories, see smack_cipso_index_new().
+ */
+struct smack_cipso_index;
+
+/*!
+ * Callback used to report the label of a process. Returning non-zero
+ * stops the enumeration.
+ */
+typedef int (*smack_process_fn)(pid_t pid, const char *label, void *data);
+
+/*!
+ * Callback used to report labels from a query. Returning non-zero stops
+ * the query.
+ */
+typedef int (*smack_label_fn)(const char *label, smack_label_id id,
+			      void *data);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -149,6 +244,244 @@ int smack_accesses_add_from_file(struct smack_accesses *handle, int fd);
 int smack_have_access(const char *subject, const char *object,
 		      const char *access_type);
 
+/*!
+ * Intern a label into the given access rules and return its identifier.
+ * The label is validated only once, identifiers returned for the same
+ * label are always equal and they are shared with the rules added by
+ * smack_accesses_add() and friends.
+ *
+ * @param handle handle to a struct smack_accesses instance
+ * @param label label to intern
+ * @return Returns a non-negative label identifier on success and negative
+ * on failure.
+ */
+smack_label_id smack_accesses_label_id(struct smack_accesses *handle,
+				       const char *label);
+
+/*!
+ * Get the label string for the given identifier. The returned string is
+ * owned by the handle and stays valid until smack_accesses_free().
+ *
+ * @param handle handle to a struct smack_accesses instance
+ * @param id label identifier
+ * @return Returns the label or NULL if the identifier is not known.
+ */
+const char *smack_accesses_label(struct smack_accesses *handle,
+				 smack_label_id id);
+
+/*!
+ * Add a new rule to the given access rules using interned labels.
+ *
+ * @param handle handle to a struct smack_accesses instance
+ * @param subject_id identifier of the subject label
+ * @param object_id identifier of the object label
+ * @param access_type access type
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_accesses_add_by_id(struct smack_accesses *handle,
+			     smack_label_id subject_id,
+			     smack_label_id object_id,
+			     const char *access_type);
+
+/*!
+ * Add a modification rule to the given access rules using interned labels.
+ * See smack_accesses_add_modify() for the semantics.
+ *
+ * @param handle handle to a struct smack_accesses instance
+ * @param subject_id identifier of the subject label
+ * @param object_id identifier of the object label
+ * @param allow_access_type access type to be turned on
+ * @param deny_access_type access type to be turned off
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_accesses_add_modify_by_id(struct smack_accesses *handle,
+				    smack_label_id subject_id,
+				    smack_label_id object_id,
+				    const char *allow_access_type,
+				    const char *deny_access_type);
+
+/*!
+ * Check whether SMACK allows access for the given interned subject and
+ * object labels. The labels are not validated again.
+ *
+ * @param handle handle to a struct smack_accesses instance
+ * @param subject_id identifier of the subject label
+ * @param object_id identifier of the object label
+ * @param access_type requested access type
+ * @return Returns 1 if access is allowed, 0 if access is not allowed and
+ * negative on error.
+ */
+int smack_have_access_by_id(struct smack_accesses *handle,
+			    smack_label_id subject_id,
+			    smack_label_id object_id,
+			    const char *access_type);
+
+/*!
+ * Compile the rules of the given handle into a new read-only policy
+ * snapshot. Rules are merged in the order they were added, the same way
+ * smack_accesses_apply() would merge them into an empty kernel policy.
+ * Label identifiers of the snapshot are the ones of the handle. The
+ * returned instance must be later freed with smack_policy_free().
+ *
+ * The snapshot does not reference the handle and it can be queried from
+ * several threads at the same time.
+ *
+ * @param policy output variable for the struct smack_policy instance
+ * @param handle handle to a struct smack_accesses instance
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_policy_new(struct smack_policy **policy,
+		     struct smack_accesses *handle);
+
+/*!
+ * Compile the rules currently loaded into the kernel into a new read-only
+ * policy snapshot. The returned instance must be later freed with
+ * smack_policy_free().
+ *
+ * @param policy output variable for the struct smack_policy instance
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_policy_new_from_kernel(struct smack_policy **policy);
+
+/*!
+ * Destroys a struct smack_policy instance.
+ *
+ * @param policy handle to a struct smack_policy instance
+ */
+void smack_policy_free(struct smack_policy *policy);
+
+/*!
+ * Check whether the given policy allows access for given subject, object
+ * and requested access. Built-in Smack rules are applied the same way as
+ * the kernel does.
+ *
+ * @param policy handle to a struct smack_policy instance
+ * @param subject subject of the rule
+ * @param object object of the rule
+ * @param access_type requested access type
+ * @return Returns 1 if access is allowed, 0 if access is not allowed and
+ * negative on error.
+ */
+int smack_policy_have_access(struct smack_policy *policy, const char *subject,
+			     const char *object, const char *access_type);
+
+/*!
+ * Check whether the given policy allows access for the given subject and
+ * object label identifiers.
+ *
+ * @param policy handle to a struct smack_policy instance
+ * @param subject_id identifier of the subject label
+ * @param object_id identifier of the object label
+ * @param access_type requested access type
+ * @return Returns 1 if access is allowed, 0 if access is not allowed and
+ * negative on error.
+ */
+int smack_policy_have_access_by_id(struct smack_policy *policy,
+				   smack_label_id subject_id,
+				   smack_label_id object_id,
+				   const char *access_type);
+
+/*!
+ * Report every subject label that has the requested access to the given
+ * object through an explicit rule. Subjects with the same access type are
+ * reported together, so the cost is proportional to the number of
+ * reported labels. Built-in Smack rules are not taken into account.
+ *
+ * @param policy handle to a struct smack_policy instance
+ * @param object object of the rules
+ * @param access_type requested access type
+ * @param fn callback called for each subject label
+ * @param data opaque data passed to the callback
+ * @return Returns the number of reported labels on success and negative
+ * on failure.
+ */
+int smack_policy_for_each_subject(struct smack_policy *policy,
+				  const char *object, const char *access_type,
+				  smack_label_fn fn, void *data);
+
+/*!
+ * Report every object label to which the given subject has the requested
+ * access through an explicit rule. See smack_policy_for_each_subject().
+ *
+ * @param policy handle to a struct smack_policy instance
+ * @param subject subject of the rules
+ * @param access_type requested access type
+ * @param fn callback called for each object label
+ * @param data opaque data passed to the callback
+ * @return Returns the number of reported labels on success and negative
+ * on failure.
+ */
+int smack_policy_for_each_object(struct smack_policy *policy,
+				 const char *subject, const char *access_type,
+				 smack_label_fn fn, void *data);
+
+/*!
+ * Allocates memory for a new smack_shared_policy instance with no policy
+ * published. The returned instance must be later freed with
+ * smack_shared_policy_free().
+ *
+ * @param shared output variable for the struct smack_shared_policy instance
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_shared_policy_new(struct smack_shared_policy **shared);
+
+/*!
+ * Destroys a struct smack_shared_policy instance together with the policy
+ * published in it. There must be no readers left.
+ *
+ * @param shared handle to a struct smack_shared_policy instance
+ */
+void smack_shared_policy_free(struct smack_shared_policy *shared);
+
+/*!
+ * Publish a new policy snapshot. The instance takes ownership of the
+ * policy. The previously published snapshot is freed once all readers
+ * that could have seen it have left, so the call waits for them.
+ * Concurrent publishers are serialized.
+ *
+ * @param shared handle to a struct smack_shared_policy instance
+ * @param policy the new snapshot
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_shared_policy_publish(struct smack_shared_policy *shared,
+				struct smack_policy *policy);
+
+/*!
+ * Start reading the currently published snapshot. The returned policy
+ * stays valid until smack_shared_policy_leave() is called with the same
+ * token. Readers do not take any locks and may run concurrently with
+ * smack_shared_policy_publish().
+ *
+ * @param shared handle to a struct smack_shared_policy instance
+ * @param token output variable to be passed to smack_shared_policy_leave()
+ * @return Returns the current policy or NULL if none is published.
+ */
+struct smack_policy *smack_shared_policy_enter(struct smack_shared_policy *shared,
+					       int *token);
+
+/*!
+ * Stop reading a snapshot returned by smack_shared_policy_enter().
+ *
+ * @param shared handle to a struct smack_shared_policy instance
+ * @param token token returned by smack_shared_policy_enter()
+ */
+void smack_shared_policy_leave(struct smack_shared_policy *shared, int token);
+
+/*!
+ * Check access against the currently published snapshot. See
+ * smack_policy_have_access().
+ *
+ * @param shared handle to a struct smack_shared_policy instance
+ * @param subject subject of the rule
+ * @param object object of the rule
+ * @param access_type requested access type
+ * @return Returns 1 if access is allowed, 0 if access is not allowed and
+ * negative on error or when no policy is published.
+ */
+int smack_shared_policy_have_access(struct smack_shared_policy *shared,
+				    const char *subject, const char *object,
+				    const char *access_type);
+
 /*!
  * Allocates memory for a new empty smack_cipso instance. The returned
  * instance must be later freed with smack_cipso_free().
@@ -175,7 +508,65 @@ void smack_cipso_free(struct smack_cipso *handle);
 int smack_cipso_apply(struct smack_cipso *handle);
 
 /*!
- * Add CIPSO rules from the given file.
+ * Apply to the kernel the CIPSO rules whose level or categories differ
+ * from the mapping the kernel has for their label, read back from SmackFS.
+ * If the current mappings can't be read, all rules are applied.
+ *
+ * @param handle handle to a struct smack_cipso instance
+ * @param changed output for the count of rules applied or NULL
+ * @param unchanged output for the count of rules already in effect or NULL
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_cipso_apply_changes(struct smack_cipso *handle, int *changed,
+			      int *unchanged);
+
+/*!
+ * Build an index of the CIPSO rules of handle, that are copied. The index
+ * is never modified, so it can be looked up concurrently by any number of
+ * threads without locking. It must be later freed with
+ * smack_cipso_index_free().
+ *
+ * @param index output variable for the struct smack_cipso_index instance
+ * @param handle handle to a struct smack_cipso instance
+ * @return Returns 0 on success and negative on failure.
+ */
+int smack_cipso_index_new(struct smack_cipso_index **index,
+			  const struct smack_cipso *handle);
+
+/*!
+ * Destroys a struct smack_cipso_index instance.
+ *
+ * @param index handle to a struct smack_cipso_index instance
+ */
+void smack_cipso_index_free(struct smack_cipso_index *index);
+
+/*!
+ * Get the level and categories mapped to a label.
+ *
+ * @param index handle to a struct smack_cipso_index instance
+ * @param label the label
+ * @param tuple output for the level and categories
+ * @return Returns 0 on success and negative value if label has no mapping.
+ */
+int smack_cipso_index_get_tuple(const struct smack_cipso_index *index,
+				const char *label,
+				struct smack_cipso_tuple *tuple);
+
+/*!
+ * Get the label mapped to a level and categories. If several labels have
+ * the same mapping, the first one added is returned. The label is owned
+ * by the index and stays valid until smack_cipso_index_free().
+ *
+ * @param index handle to a struct smack_cipso_index instance
+ * @param tuple the level and categories
+ * @return Returns the label or NULL if no label has this mapping.
+ */
+const char *smack_cipso_index_get_label(const struct smack_cipso_index *index,
+					const struct smack_cipso_tuple *tuple);
+
+/*!
+ * Add CIPSO rules from the given file. A label has a single mapping, the
+ * last one added, so only it is applied.
  *
  * @param handle handle to a struct smack_cipso instance
  * @param fd file descriptor
@@ -224,6 +615,36 @@ ssize_t smack_new_label_from_process(pid_t pid, char **label);
   */
 ssize_t smack_new_label_from_socket(int fd, char **label);
 
+/*!
+  * Check whether SMACK allows access for the peer on the other end of a
+  * UDS socket (SO_PEERSEC) as subject and the given object. The peer
+  * label is read into a stack buffer and validated once, no memory is
+  * allocated.
+  *
+  * @param fd file descriptor of the socket
+  * @param object object of the rule
+  * @param access_type requested access type
+  * @return Returns 1 if access is allowed, 0 if access is not allowed and
+  * negative on error.
+  */
+int smack_have_access_from_socket(int fd, const char *object,
+				  const char *access_type);
+
+/*!
+  * Same as smack_have_access_from_socket(), but also copies the peer label
+  * into a caller supplied buffer.
+  *
+  * @param fd file descriptor of the socket
+  * @param object object of the rule
+  * @param access_type requested access type
+  * @param label buffer of at least SMACK_LABEL_LEN + 1 characters for the
+  * peer label, or NULL
+  * @return Returns 1 if access is allowed, 0 if access is not allowed and
+  * negative on error.
+  */
+int smack_have_access_from_socket_label(int fd, const char *object,
+					const char *access_type, char *label);
+
 /*!
   * Get the SMACK label that is contained in an extended attribute.
   * Caller is responsible of freeing the returned label.
@@ -254,6 +675,200 @@ ssize_t smack_new_label_from_file(int fd,
 				  const char *xattr,
 				  char **label);
 
+/*!
+  * Get the label that is associated with the callers process into a caller
+  * supplied buffer. No memory is allocated.
+  *
+  * @param label buffer of at least SMACK_LABEL_LEN + 1 characters
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_get_label_from_self(char *label);
+
+/*!
+  * Get the label of the calling thread from a thread-local copy. The copy
+  * is read from /proc on the first call in a thread, afterwards no system
+  * calls are made. smack_set_label_for_self() updates the copy, use
+  * smack_refresh_label_from_self() after changing the label by other means.
+  *
+  * @param label output variable for the label, owned by the calling thread
+  * and valid until its label changes
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_cached_label_from_self(const char **label);
+
+/*!
+  * Read the label of the calling thread again into the thread-local copy
+  * used by smack_cached_label_from_self().
+  *
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_refresh_label_from_self(void);
+
+/*!
+  * Get the label that is associated with the given process into a caller
+  * supplied buffer. No memory is allocated.
+  *
+  * @param pid process descriptor to get the label for
+  * @param label buffer of at least SMACK_LABEL_LEN + 1 characters
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_get_label_from_process(pid_t pid, char *label);
+
+/*!
+  * Get the label that is associated with a peer on the other end of a
+  * UDS socket (SO_PEERSEC) into a caller supplied buffer. No memory is
+  * allocated.
+  *
+  * @param fd file descriptor of the socket
+  * @param label buffer of at least SMACK_LABEL_LEN + 1 characters
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_get_label_from_socket(int fd, char *label);
+
+/*!
+  * Get the SMACK label that is contained in an extended attribute into a
+  * caller supplied buffer. No memory is allocated.
+  *
+  * @param path path of the file
+  * @param xattr the extended attribute containing the SMACK label
+  * @param follow whether or not to follow symbolic link
+  * @param label buffer of at least SMACK_LABEL_LEN + 1 characters
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_get_label_from_path(const char *path, const char *xattr,
+				  int follow, char *label);
+
+/*!
+  * Get the SMACK label that is contained in an extended attribute into a
+  * caller supplied buffer. No memory is allocated.
+  *
+  * @param fd opened file descriptor of the file
+  * @param xattr the extended attribute containing the SMACK label
+  * @param label buffer of at least SMACK_LABEL_LEN + 1 characters
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_get_label_from_file(int fd, const char *xattr, char *label);
+
+/*!
+  * Intern a label into the process-wide label pool. Every distinct label
+  * is stored once and its interned copy is never freed, so interned labels
+  * may be compared by pointer. Only labels passed to this function and to
+  * smack_intern_label_id() enter the pool, the label getters fill caller
+  * buffers and handles keep their own copies. Lookups of labels already in
+  * the pool take no locks.
+  *
+  * @param label the label to intern
+  * @return Returns the interned label on success and NULL on failure.
+  */
+const char *smack_intern_label(const char *label);
+
+/*!
+  * Intern a label into the process-wide label pool and get its identifier.
+  * See smack_intern_label(). The identifier only names the label to
+  * smack_interned_label(), handles number their labels on their own.
+  *
+  * @param label the label to intern
+  * @return Returns the identifier on success and negative value on failure.
+  */
+smack_intern_id smack_intern_label_id(const char *label);
+
+/*!
+  * Get the interned label for an identifier returned by
+  * smack_intern_label_id().
+  *
+  * @param id identifier of the label
+  * @return Returns the interned label or NULL if the identifier is unknown.
+  */
+const char *smack_interned_label(smack_intern_id id);
+
+/*!
+  * Allocates memory for a new empty smack_process_cache instance. Labels
+  * are cached per process, identified by its pid and start time, so that
+  * a reused pid is never given the label of the previous process. The
+  * returned instance must be later freed with smack_process_cache_free().
+  * The instance must not be used from several threads at the same time.
+  *
+  * @param cache output variable for the struct smack_process_cache instance
+  * @param proc_path path of the mounted procfs or NULL for "/proc"
+  * @return Returns 0 on success and negative on failure.
+  */
+int smack_process_cache_new(struct smack_process_cache **cache,
+			    const char *proc_path);
+
+/*!
+  * Destroys a struct smack_process_cache instance.
+  *
+  * @param cache handle to a struct smack_process_cache instance
+  */
+void smack_process_cache_free(struct smack_process_cache *cache);
+
+/*!
+  * Get the label that is associated with the given process. A cached label
+  * is revalidated with a single stat of the /proc entry of the process,
+  * which changes when the pid is reused. The label is read again only when
+  * the process start time has changed. Label changes of a still running
+  * process are not noticed, use smack_process_cache_invalidate() for that.
+  *
+  * @param cache handle to a struct smack_process_cache instance
+  * @param pid process descriptor to get the label for
+  * @param label output variable for the label, owned by the cache and
+  * valid until the next call for the same pid
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_process_cache_get(struct smack_process_cache *cache, pid_t pid,
+				const char **label);
+
+/*!
+  * Get labels of several processes. See smack_process_cache_get().
+  *
+  * @param cache handle to a struct smack_process_cache instance
+  * @param pids array of process descriptors
+  * @param labels output array for the labels, NULL is stored for the
+  * processes whose label could not be read
+  * @param cnt number of processes
+  * @return Returns number of labels found.
+  */
+int smack_process_cache_get_many(struct smack_process_cache *cache,
+				 const pid_t *pids, const char **labels,
+				 int cnt);
+
+/*!
+  * Drop the cached label of the given process.
+  *
+  * @param cache handle to a struct smack_process_cache instance
+  * @param pid process descriptor
+  */
+void smack_process_cache_invalidate(struct smack_process_cache *cache,
+				    pid_t pid);
+
+/*!
+  * Report the label of every process. Entries of procfs are opened
+  * relative to a single directory descriptor and labels are read into
+  * reused buffers, no memory is allocated per process. Processes that exit
+  * during the enumeration are skipped.
+  *
+  * When more than one thread is requested, the processes are split between
+  * the calling thread and additional worker threads and the callback is
+  * called concurrently from all of them.
+  *
+  * @param proc_path path of the mounted procfs or NULL for "/proc"
+  * @param threads number of threads to use
+  * @param fn callback called for each process
+  * @param data opaque data passed to the callback
+  * @return Returns the number of reported processes on success and
+  * negative on failure.
+  */
+int smack_foreach_process_label(const char *proc_path, int threads,
+				smack_process_fn fn, void *data);
+
 /*!
   * Set the SMACK label in an extended attribute.
   *
@@ -280,6 +895,50 @@ int smack_set_label_for_file(int fd,
 				  const char *xattr,
 				  const char *label);
 
+/*!
+  * Set the SMACK label in an extended attribute only if the attribute does
+  * not already hold that label. The current value is read first, so a
+  * file that is already labeled correctly is not written to.
+  *
+  * @param path path of the file
+  * @param xattr the extended attribute containing the SMACK label
+  * @param follow whether or not to follow symbolic link
+  * @param label the label to set
+  * @return Returns 1 if the label was written, 0 if it was already set and
+  * negative value on failure.
+  */
+int smack_update_label_for_path(const char *path, const char *xattr,
+				int follow, const char *label);
+
+/*!
+  * Same as smack_update_label_for_path(), but for an opened file.
+  *
+  * @param fd opened file descriptor of the file
+  * @param xattr the extended attribute containing the SMACK label
+  * @param label the label to set
+  * @return Returns 1 if the label was written, 0 if it was already set and
+  * negative value on failure.
+  */
+int smack_update_label_for_file(int fd, const char *xattr,
+				const char *label);
+
+/*!
+  * Same as smack_update_label_for_path(), but for a file given relative to
+  * a directory descriptor, see openat(2).
+  *
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param label the label to set
+  * @return Returns 1 if the label was written, 0 if it was already set and
+  * negative value on failure.
+  */
+int smack_update_label_for_path_at(int dirfd, const char *path,
+				   const char *xattr, int flags,
+				   const char *label);
+
 /*!
   * Remove the SMACK label in an extended attribute.
   *
@@ -301,9 +960,237 @@ int smack_remove_label_for_path(const char *path,
   */
 int smack_remove_label_for_file(int fd, const char *xattr);
 
+/*!
+ * Flag of the *_at() functions giving the type of the file, as found in
+ * the d_type field of a struct dirent. It saves the fstatat(2) call made
+ * when the *xattrat() syscalls are not available. DT_UNKNOWN gives no
+ * hint, and a DT_LNK that is followed is looked up anyway.
+ */
+#define SMACK_AT_DTYPE(type) (((type) & 0xf) << 24)
+
+/*!
+  * Get the SMACK label that is contained in an extended attribute of a file
+  * given relative to a directory descriptor, see openat(2). With AT_FDCWD
+  * or an absolute path the path based xattr calls are used directly.
+  * Otherwise the getxattrat(2) family of Linux 6.13 is used. On older
+  * kernels the type of the file is looked up with fstatat(2), unless given
+  * with SMACK_AT_DTYPE(): regular files and directories are opened
+  * read-only relative to dirfd and the attribute is accessed through that
+  * descriptor, other files, and files that can't be opened, through
+  * /proc/self/fd/<dirfd>/<path>, so for them the path is resolved again
+  * under /proc.
+  * Caller is responsible of freeing the returned label.
+  *
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param label output variable for the returned label
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_new_label_from_path_at(int dirfd, const char *path,
+				     const char *xattr, int flags,
+				     char **label);
+
+/*!
+  * Same as smack_new_label_from_path_at(), but the label is stored into a
+  * caller supplied buffer of at least SMACK_LABEL_LEN + 1 characters.
+  *
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param label buffer for the label
+  * @return Returns length of the label on success and negative value
+  * on failure.
+  */
+ssize_t smack_get_label_from_path_at(int dirfd, const char *path,
+				     const char *xattr, int flags,
+				     char *label);
+
+/*!
+  * Set the SMACK label in an extended attribute of a file given relative
+  * to a directory descriptor. See smack_new_label_from_path_at().
+  *
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param label the label to set
+  * @return Returns 0 on success and negative value on failure.
+  */
+int smack_set_label_for_path_at(int dirfd, const char *path,
+				const char *xattr, int flags,
+				const char *label);
+
+/*!
+  * Remove the SMACK label in an extended attribute of a file given relative
+  * to a directory descriptor. See smack_new_label_from_path_at().
+  *
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @return Returns 0 on success and negative on failure.
+  */
+int smack_remove_label_for_path_at(int dirfd, const char *path,
+				   const char *xattr, int flags);
+
+/*!
+  * Get all SMACK attributes of a file at once: SMACK64, SMACK64EXEC,
+  * SMACK64MMAP and SMACK64TRANSMUTE. The attributes present on the file
+  * are found with a single listxattr call and only those are read.
+  * Attributes whose value is not a valid label are reported as absent, an
+  * attribute that can't be read fails the call, with ERANGE if its value
+  * is longer than SMACK_LABEL_LEN + 1 bytes.
+  *
+  * @param fd open file descriptor of the file, descriptors opened with
+  * O_PATH are not supported by the xattr calls
+  * @param labels output variable for the labels
+  * @return Returns the number of attributes found on success and negative
+  * value on failure.
+  */
+int smack_get_file_labels(int fd, struct smack_file_labels *labels);
+
+/*!
+  * Same as smack_get_file_labels(), but for a file given by path. The path
+  * is resolved by each xattr call, see smack_get_file_labels_at().
+  *
+  * @param path path of the file
+  * @param follow whether or not to follow symbolic link
+  * @param labels output variable for the labels
+  * @return Returns the number of attributes found on success and negative
+  * value on failure.
+  */
+int smack_get_path_labels(const char *path, int follow,
+			  struct smack_file_labels *labels);
+
+/*!
+  * Same as smack_get_file_labels(), but for a file given relative to a
+  * directory descriptor, see openat(2). The file is looked up as by
+  * smack_new_label_from_path_at().
+  *
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param labels output variable for the labels
+  * @return Returns the number of attributes found on success and negative
+  * value on failure.
+  */
+int smack_get_file_labels_at(int dirfd, const char *path, int flags,
+			     struct smack_file_labels *labels);
+
+/*!
+  * Allocates a new queue of label operations. Queued operations are sent
+  * to the kernel in batches with io_uring when the kernel supports its
+  * getxattr and setxattr operations. io_uring always follows symbolic
+  * links and can't remove attributes, so operations with
+  * AT_SYMLINK_NOFOLLOW or AT_EMPTY_PATH, removals, and all operations when
+  * io_uring isn't available are carried out by a pool of threads.
+  * Callbacks are called from the thread using the queue, from inside the
+  * smack_label_batch_*() functions. The instance must not be used from
+  * several threads at the same time.
+  *
+  * @param batch output variable for the struct smack_label_batch instance
+  * @param depth maximum number of operations in flight
+  * @param flags SMACK_BATCH_THREADS to never use io_uring or 0
+  * @return Returns 0 on success and negative on failure.
+  */
+int smack_label_batch_new(struct smack_label_batch **batch, int depth,
+			  int flags);
+
+/*!
+  * Complete the queued operations and destroy the queue.
+  *
+  * @param batch handle to a struct smack_label_batch instance
+  */
+void smack_label_batch_free(struct smack_label_batch *batch);
+
+/*!
+  * Tell whether the queue sends operations with io_uring.
+  *
+  * @param batch handle to a struct smack_label_batch instance
+  * @return Returns 1 if io_uring is used and 0 otherwise.
+  */
+int smack_label_batch_uses_io_uring(struct smack_label_batch *batch);
+
+/*!
+  * Queue reading a label, see smack_get_label_from_path_at(). The path,
+  * the attribute name and the label buffer must stay valid until the
+  * callback is called. When the queue is full, this waits for operations
+  * to complete first.
+  *
+  * @param batch handle to a struct smack_label_batch instance
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param label buffer of at least SMACK_LABEL_LEN + 1 characters
+  * @param fn callback called with the result or NULL
+  * @param data argument given to the callback
+  * @return Returns 0 on success and negative value on failure.
+  */
+int smack_label_batch_get(struct smack_label_batch *batch, int dirfd,
+			  const char *path, const char *xattr, int flags,
+			  char *label, smack_batch_fn fn, void *data);
+
+/*!
+  * Queue setting a label, see smack_set_label_for_path_at() and
+  * smack_label_batch_get().
+  *
+  * @param batch handle to a struct smack_label_batch instance
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param label the label to set
+  * @param fn callback called with the result or NULL
+  * @param data argument given to the callback
+  * @return Returns 0 on success and negative value on failure.
+  */
+int smack_label_batch_set(struct smack_label_batch *batch, int dirfd,
+			  const char *path, const char *xattr, int flags,
+			  const char *label, smack_batch_fn fn, void *data);
+
+/*!
+  * Queue removing a label, see smack_remove_label_for_path_at() and
+  * smack_label_batch_get().
+  *
+  * @param batch handle to a struct smack_label_batch instance
+  * @param dirfd directory descriptor or AT_FDCWD
+  * @param path path of the file relative to dirfd
+  * @param xattr the extended attribute containing the SMACK label
+  * @param flags AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH and SMACK_AT_DTYPE()
+  * are supported
+  * @param fn callback called with the result or NULL
+  * @param data argument given to the callback
+  * @return Returns 0 on success and negative value on failure.
+  */
+int smack_label_batch_remove(struct smack_label_batch *batch, int dirfd,
+			     const char *path, const char *xattr, int flags,
+			     smack_batch_fn fn, void *data);
+
+/*!
+  * Wait until all queued operations are completed, including the ones
+  * queued by the callbacks.
+  *
+  * @param batch handle to a struct smack_label_batch instance
+  * @return Returns 0 on success and negative value on failure.
+  */
+int smack_label_batch_flush(struct smack_label_batch *batch);
+
 /*!
  * Set the label associated with the callers process. The caller must have
- * CAP_MAC_ADMIN POSIX capability in order to do this.
+ * CAP_MAC_ADMIN POSIX capability in order to do this. On success the
+ * copy of smack_cached_label_from_self() is updated as well.
  *
  * @param label a string containing the new label
  * @return Returns 0 on success and negative on failure.
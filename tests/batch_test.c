@@ -0,0 +1,265 @@
+/*
+ * Test of batched label operations with both backends.
+ *
+ * Usage: batch_test [files [depth]]
+ *
+ * Files and a symbolic link are created in a temporary directory, labels
+ * are set on them through a smack_label_batch, then read back both through
+ * the batch and with smack_get_label_from_path_at(). Removing a label and
+ * failing operations are checked too. The round trip is run with a batch
+ * created with flags 0, which uses io_uring, and with one created with
+ * SMACK_BATCH_THREADS; the io_uring run is skipped when io_uring isn't
+ * available. Setting security.SMACK64 needs CAP_MAC_ADMIN or CAP_SYS_ADMIN
+ * on filesystems without Smack, the test is skipped with status 77 when it
+ * is denied.
+ */
+#include <sys/smack.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define XATTR "security.SMACK64"
+
+struct file {
+	char name[32];
+	char label[SMACK_LABEL_LEN + 1];
+	char read[SMACK_LABEL_LEN + 1];
+	ssize_t result;
+	int error;
+	int done;
+};
+
+static char root[] = "/tmp/batch_test.XXXXXX";
+static struct file *files;
+static int nfiles = 1000;
+static int depth = 64;
+static int failures;
+static const char *backend;
+
+static void *check_ptr(void *ptr)
+{
+	if (!ptr) {
+		fprintf(stderr, "memory depletion!\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+static void fail(const char *what, const char *name)
+{
+	fprintf(stderr, "FAIL: %s: %s: %s\n", backend, what, name);
+	failures++;
+}
+
+static void completed(ssize_t result, void *data)
+{
+	struct file *file = data;
+
+	file->result = result;
+	file->error = result < 0 ? errno : 0;
+	file->done++;
+}
+
+static void cleanup(void)
+{
+	char path[256];
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/%s", root, files[i].name);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/link", root);
+	unlink(path);
+	rmdir(root);
+}
+
+static void reset(void)
+{
+	int i;
+
+	for (i = 0; i <= nfiles; i++) {
+		files[i].done = 0;
+		files[i].result = 0;
+		files[i].read[0] = '\0';
+	}
+}
+
+static void check_done(const char *what, int expect_ok)
+{
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		if (files[i].done != 1)
+			fail(what, "callback not called once");
+		else if ((files[i].result < 0) == expect_ok)
+			fail(what, files[i].name);
+	}
+}
+
+/* set, read back and remove the labels through a batch created with
+ * flags */
+static void round_trip(int dirfd, int flags, const char *name)
+{
+	struct smack_label_batch *batch;
+	struct file *link = &files[nfiles];
+	char label[SMACK_LABEL_LEN + 1];
+	int i;
+
+	backend = name;
+	reset();
+	/* each backend sets labels of its own, so labels left by the other
+	 * one are not taken for its results */
+	for (i = 0; i < nfiles; i++)
+		snprintf(files[i].label, sizeof(files[i].label), "%s%d", name,
+			 i % 13);
+	snprintf(link->label, sizeof(link->label), "%sLink", name);
+	if (smack_label_batch_new(&batch, depth, flags)) {
+		perror("smack_label_batch_new");
+		exit(1);
+	}
+	if (smack_label_batch_uses_io_uring(batch) != !flags) {
+		smack_label_batch_free(batch);
+		if (flags)
+			fail("SMACK_BATCH_THREADS", "io_uring is used");
+		else
+			printf("SKIP: %s: io_uring is not available\n", backend);
+		return;
+	}
+
+	/* set, then read back through the batch */
+	for (i = 0; i < nfiles; i++)
+		if (smack_label_batch_set(batch, dirfd, files[i].name, XATTR,
+					  0, files[i].label, completed,
+					  &files[i]))
+			fail("queue set", files[i].name);
+	if (smack_label_batch_set(batch, dirfd, link->name, XATTR,
+				  AT_SYMLINK_NOFOLLOW, link->label, completed,
+				  link))
+		fail("queue set", link->name);
+	if (smack_label_batch_flush(batch))
+		fail("flush", "set");
+	check_done("set", 1);
+	if (link->done != 1 || link->result < 0)
+		fail("set", link->name);
+
+	reset();
+	for (i = 0; i < nfiles; i++)
+		smack_label_batch_get(batch, dirfd, files[i].name, XATTR, 0,
+				      files[i].read, completed, &files[i]);
+	smack_label_batch_get(batch, dirfd, link->name, XATTR,
+			      AT_SYMLINK_NOFOLLOW, link->read, completed,
+			      link);
+	if (smack_label_batch_flush(batch))
+		fail("flush", "get");
+	check_done("get", 1);
+	for (i = 0; i <= nfiles; i++) {
+		if (strcmp(files[i].read, files[i].label) ||
+		    files[i].result != (ssize_t)strlen(files[i].label))
+			fail("get returned another label", files[i].name);
+		if (smack_get_label_from_path_at(dirfd, files[i].name, XATTR,
+						 AT_SYMLINK_NOFOLLOW,
+						 label) < 0 ||
+		    strcmp(label, files[i].label))
+			fail("label read synchronously", files[i].name);
+	}
+
+	/* remove every other label */
+	reset();
+	for (i = 0; i < nfiles; i++)
+		if (i % 2)
+			smack_label_batch_remove(batch, dirfd, files[i].name,
+						 XATTR, 0, completed,
+						 &files[i]);
+		else
+			files[i].done = 1;
+	smack_label_batch_flush(batch);
+	check_done("remove", 1);
+	for (i = 0; i < nfiles; i++)
+		if ((smack_get_label_from_path_at(dirfd, files[i].name, XATTR,
+						  0, label) < 0) != (i % 2))
+			fail("label after remove", files[i].name);
+
+	/* failures are reported to the callback */
+	reset();
+	smack_label_batch_set(batch, dirfd, "missing", XATTR, 0, "Label",
+			      completed, link);
+	smack_label_batch_flush(batch);
+	if (link->done != 1 || link->result >= 0 || link->error != ENOENT)
+		fail("set on a missing file", "missing");
+	if (smack_label_batch_set(batch, dirfd, files[0].name, XATTR, 0,
+				  "-invalid", completed, &files[0]) >= 0)
+		fail("queue invalid label", files[0].name);
+
+	smack_label_batch_free(batch);
+}
+
+int main(int argc, char **argv)
+{
+	struct file *link;
+	char path[256];
+	int dirfd;
+	int fd;
+	int i;
+
+	if (argc > 1)
+		nfiles = atoi(argv[1]);
+	if (argc > 2)
+		depth = atoi(argv[2]);
+
+	if (mkdtemp(root) == NULL) {
+		perror(root);
+		return 1;
+	}
+	files = check_ptr(calloc(nfiles + 1, sizeof(struct file)));
+	atexit(cleanup);
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(files[i].name, sizeof(files[i].name), "file%d", i);
+		snprintf(path, sizeof(path), "%s/%s", root, files[i].name);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0) {
+			perror(path);
+			return 1;
+		}
+		close(fd);
+	}
+	link = &files[nfiles];
+	strcpy(link->name, "link");
+	snprintf(path, sizeof(path), "%s/link", root);
+	if (symlink(files[0].name, path)) {
+		perror(path);
+		return 1;
+	}
+
+	dirfd = open(root, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0) {
+		perror(root);
+		return 1;
+	}
+
+	if (smack_set_label_for_path_at(dirfd, files[0].name, XATTR, 0,
+					"Probe") < 0) {
+		if (errno == EPERM || errno == ENOTSUP) {
+			printf("SKIP: can't set %s in %s\n", XATTR, root);
+			return 77;
+		}
+		perror("smack_set_label_for_path_at");
+		return 1;
+	}
+
+	round_trip(dirfd, 0, "io_uring");
+	round_trip(dirfd, SMACK_BATCH_THREADS, "threads");
+	close(dirfd);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("PASS: %d files\n", nfiles);
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Test of smack_cipso_apply_changes() against a stand-in smackfs.
+ *
+ * Usage: cipso_test
+ *
+ * A temporary directory takes the place of smackfs, its cipso2 file holds
+ * the mappings the "kernel" has. The test is built with the library
+ * sources to point the library at the directory. As cipso2 is a plain
+ * file it takes the first record of the multiline check, so records are
+ * written one per write(), each after the previous one from the start of
+ * the file. The kernel mappings are put after a run of newlines that the
+ * records overwrite, what was written is read back up to the rest of it.
+ */
+#include <sys/smack.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PADDING 1024
+
+extern char *smackfs_mnt;
+extern int smackfs_mnt_dirfd;
+
+static char root[] = "/tmp/cipso_test.XXXXXX";
+static char cipso2[64];
+static char rules[64];
+static int failures;
+
+static void write_file(const char *path, const char *data, int padding)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	char pad[PADDING];
+
+	memset(pad, '\n', sizeof(pad));
+	if (fd < 0 || write(fd, pad, padding) < 0 ||
+	    write(fd, data, strlen(data)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	close(fd);
+}
+
+static void cleanup(void)
+{
+	unlink(cipso2);
+	unlink(rules);
+	rmdir(root);
+}
+
+/* apply rules on the kernel mappings, check the counts and the records
+ * written */
+static void check(const char *name, const char *rules_data,
+		  const char *kernel, int changed, int unchanged,
+		  const char *written)
+{
+	struct smack_cipso *cipso;
+	char buf[PADDING + 1];
+	char *end;
+	int ch = -1, un = -1;
+	ssize_t len;
+	int fd;
+
+	write_file(rules, rules_data, 0);
+	write_file(cipso2, kernel, PADDING);
+
+	fd = open(rules, O_RDONLY);
+	if (fd < 0 || smack_cipso_new(&cipso) ||
+	    smack_cipso_add_from_file(cipso, fd)) {
+		printf("FAIL: %s: reading rules\n", name);
+		exit(1);
+	}
+	close(fd);
+
+	if (smack_cipso_apply_changes(cipso, &ch, &un)) {
+		printf("FAIL: %s: smack_cipso_apply_changes\n", name);
+		failures++;
+	} else if (ch != changed || un != unchanged) {
+		printf("FAIL: %s: changed=%d unchanged=%d, expected %d and %d\n",
+		       name, ch, un, changed, unchanged);
+		failures++;
+	}
+	smack_cipso_free(cipso);
+
+	fd = open(cipso2, O_RDONLY);
+	len = read(fd, buf, PADDING);
+	close(fd);
+	buf[len < 0 ? 0 : len] = '\0';
+	end = strstr(buf, "\n\n");
+	if (end != NULL)
+		*end = '\0';
+	if (strcmp(buf, written)) {
+		printf("FAIL: %s: wrote [%s], expected [%s]\n", name, buf,
+		       written);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	if (mkdtemp(root) == NULL) {
+		perror(root);
+		return 1;
+	}
+	snprintf(cipso2, sizeof(cipso2), "%s/cipso2", root);
+	snprintf(rules, sizeof(rules), "%s/rules", root);
+	atexit(cleanup);
+
+	smackfs_mnt = strdup(root);
+	smackfs_mnt_dirfd = open(root, O_RDONLY | O_DIRECTORY);
+	if (smackfs_mnt == NULL || smackfs_mnt_dirfd < 0) {
+		perror(root);
+		return 1;
+	}
+
+	/* A and B are mapped already, A in another order of categories and
+	 * redefined later; C and D differ, E is new */
+	check("changes",
+	      "A 1 2 3\nB 7\nC 9 2\nD 5 1\nE 3\nA 1 3 2\n",
+	      "A 1/2,3\nB   7\nC 9/1\nD 250/1,190\n_ 250\n",
+	      3, 2,
+	      "C 9   1   2   \n-D 5   1   1   E 3   0   ");
+
+	check("unchanged",
+	      "A 1 2 3\nB 7\n",
+	      "A 1/2,3\nB 7\n",
+	      0, 2, "");
+
+	check("empty kernel",
+	      "A 1 2 3\nB 7\n",
+	      "",
+	      2, 0,
+	      "A 1   2   2   3   \n-B 7   0   ");
+
+	check("long label",
+	      "LongLabelThatDoesNotFitTheOldCipsoFormat 4 1\n",
+	      "LongLabelThatDoesNotFitTheOldCipsoFormat 4/2\n",
+	      1, 0,
+	      "LongLabelThatDoesNotFitTheOldCipsoFormat 4   1   1   ");
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
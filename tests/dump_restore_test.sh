@@ -0,0 +1,74 @@
+#!/bin/bash
+#This script checks that chsmack --restore brings back the attributes
+#written by chsmack --dump. The tree is made on a tmpfs when one can be
+#mounted, in a temporary directory otherwise.
+#The chsmack to test is given by $CHSMACK, ../utils/chsmack by default.
+#Exits with 77 when the attributes can't be set.
+
+chsmack=`realpath "${CHSMACK:-../utils/chsmack}"`
+test -x "$chsmack" || { echo "no chsmack: $chsmack"; exit 1; }
+
+dir=`mktemp -d /tmp/dump_restore_test.XXXXXX` || exit 1
+mount -t tmpfs tmpfs "$dir" 2>/dev/null && mounted=1
+
+cleanup()
+{
+	cd /
+	test -n "$mounted" && umount "$dir"
+	rm -rf "$dir"
+}
+trap cleanup EXIT
+
+fail()
+{
+	echo "FAIL: $*"
+	exit 1
+}
+
+cd "$dir" || exit 1
+mkdir -p tree/bin tree/var/log "tree/with space" tree/empty
+echo data > tree/bin/ls
+echo data > tree/var/log/messages
+echo data > "tree/with space/file name"
+echo data > tree/unlabeled
+#names that would break the lines of a dump unless escaped
+echo data > "tree/with space/new
+line"
+echo data > "tree/with space/fake access=\"Fake\""
+echo data > "tree/with space/back\\012slash"
+ln tree/bin/ls tree/bin/hardlink
+ln -s ../bin/ls tree/var/link
+
+if ! "$chsmack" -a Probe tree/unlabeled 2>/dev/null ||
+   ! "$chsmack" -A tree/unlabeled; then
+	echo "SKIP: can't set the attributes in $dir"
+	exit 77
+fi
+
+"$chsmack" -r -a Floor tree || fail "labeling tree"
+"$chsmack" -a System -e System tree/bin/ls || fail "labeling ls"
+"$chsmack" -a Log -t tree/var/log || fail "labeling log"
+"$chsmack" -a Link tree/var/link || fail "labeling link"
+"$chsmack" -m Map "tree/with space/file name" || fail "labeling file name"
+"$chsmack" -a Quoted "tree/with space/fake access=\"Fake\"" ||
+	fail "labeling quoted name"
+"$chsmack" -A tree/unlabeled tree/empty || fail "unlabeling"
+
+"$chsmack" -O before.dump tree || fail "dump"
+test `wc -l < before.dump` -eq 15 || fail "dump has `wc -l < before.dump` lines"
+
+#change every kind of attribute, then restore
+"$chsmack" -r -a Other -e Other -m Other tree || fail "relabeling tree"
+"$chsmack" -T tree/var/log || fail "untransmuting log"
+"$chsmack" -t tree/empty || fail "transmuting empty"
+
+"$chsmack" -I before.dump || fail "restore"
+"$chsmack" -O after.dump tree || fail "dump after restore"
+diff -u before.dump after.dump || fail "attributes differ after restore"
+
+#restoring unchanged attributes is a no-op
+"$chsmack" -I before.dump || fail "second restore"
+"$chsmack" -O again.dump tree || fail "dump after second restore"
+diff -u before.dump again.dump || fail "attributes differ after second restore"
+
+echo "PASS: `wc -l < before.dump` files${mounted:+ on tmpfs}"
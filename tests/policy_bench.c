@@ -0,0 +1,167 @@
+/*
+ * Benchmark of concurrent access checks against a shared policy snapshot.
+ *
+ * Usage: policy_bench [labels [rules [seconds [threads [publish_ms]]]]]
+ *
+ * A random policy is compiled and published, then the same number of
+ * checks is run with 1, 2, 4, ... up to 'threads' reader threads and the
+ * aggregated checks per second are printed for each count. When
+ * 'publish_ms' is not zero, a writer thread republishes a new snapshot of
+ * the policy at that interval while the readers run.
+ */
+#include <sys/smack.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct smack_shared_policy *shared;
+static struct smack_accesses *rules;
+static char **labels;
+static int nlabels = 1024;
+static int nrules = 100000;
+static int seconds = 2;
+static int publish_ms = 0;
+static unsigned long publishes;
+static volatile int running;
+
+static void *check_ptr(void *ptr)
+{
+	if (!ptr) {
+		fprintf(stderr, "memory depletion!\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void publish(void)
+{
+	struct smack_policy *policy;
+
+	if (smack_policy_new(&policy, rules) ||
+	    smack_shared_policy_publish(shared, policy)) {
+		fprintf(stderr, "publishing policy failed\n");
+		exit(1);
+	}
+}
+
+static void *reader(void *arg)
+{
+	unsigned int seed = (unsigned int)(long)arg;
+	unsigned long checks = 0;
+	int i;
+
+	while (running) {
+		for (i = 0; i < 1024; i++)
+			smack_shared_policy_have_access(shared,
+				labels[rand_r(&seed) % nlabels],
+				labels[rand_r(&seed) % nlabels], "r");
+		checks += i;
+	}
+
+	return (void *)checks;
+}
+
+static void *writer(void *arg)
+{
+	(void)arg;
+	while (running) {
+		usleep(publish_ms * 1000);
+		publish();
+		publishes++;
+	}
+	return NULL;
+}
+
+static double run(int threads)
+{
+	pthread_t tids[threads];
+	pthread_t wtid;
+	unsigned long total = 0;
+	void *checks;
+	double start;
+	int i;
+
+	running = 1;
+	publishes = 0;
+	start = now();
+	for (i = 0; i < threads; i++)
+		pthread_create(&tids[i], NULL, reader, (void *)(long)(i + 1));
+	if (publish_ms)
+		pthread_create(&wtid, NULL, writer, NULL);
+
+	sleep(seconds);
+	running = 0;
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], &checks);
+		total += (unsigned long)checks;
+	}
+	if (publish_ms)
+		pthread_join(wtid, NULL);
+
+	return total / (now() - start);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *codes[] = {"r", "rw", "rx", "rwxa", "w", "l"};
+	char buf[32];
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	double base = 0;
+	double rate;
+	int i;
+
+	if (argc > 1)
+		nlabels = atoi(argv[1]);
+	if (argc > 2)
+		nrules = atoi(argv[2]);
+	if (argc > 3)
+		seconds = atoi(argv[3]);
+	if (argc > 4)
+		max_threads = atoi(argv[4]);
+	if (argc > 5)
+		publish_ms = atoi(argv[5]);
+
+	labels = check_ptr(calloc(nlabels, sizeof(char *)));
+	for (i = 0; i < nlabels; i++) {
+		snprintf(buf, sizeof(buf), "Label%d", i);
+		labels[i] = check_ptr(strdup(buf));
+	}
+
+	if (smack_accesses_new(&rules) || smack_shared_policy_new(&shared)) {
+		fprintf(stderr, "memory depletion!\n");
+		return 1;
+	}
+	for (i = 0; i < nrules; i++)
+		smack_accesses_add(rules, labels[random() % nlabels],
+				   labels[random() % nlabels],
+				   codes[random() % 6]);
+	publish();
+
+	printf("%d labels, %d rules\n", nlabels, nrules);
+	for (i = 1; i <= max_threads; i *= 2) {
+		rate = run(i);
+		if (i == 1)
+			base = rate;
+		printf("%3d threads: %12.0f checks/s  (x%.2f)",
+		       i, rate, rate / base);
+		if (publish_ms)
+			printf("  %lu publishes", publishes);
+		printf("\n");
+	}
+
+	smack_shared_policy_free(shared);
+	smack_accesses_free(rules);
+	return 0;
+}
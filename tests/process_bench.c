@@ -0,0 +1,178 @@
+/*
+ * Benchmark of the process label cache on a stand-in /proc tree.
+ *
+ * Usage: process_bench [processes [rounds]]
+ *
+ * A /proc-like tree with the given number of processes is created in a
+ * temporary directory. Each round reads the labels of all processes once
+ * the way smack_new_label_from_process() does and once through a
+ * smack_process_cache, then the time per lookup of both is printed.
+ * Finally half of the pids are "reused" with a new start time and label
+ * and the cache is checked to return the new labels.
+ */
+#include <sys/smack.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char root[] = "/tmp/process_bench.XXXXXX";
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_file(const char *path, const char *data)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0 || write(fd, data, strlen(data)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	close(fd);
+}
+
+static void make_process(int pid, unsigned long long starttime)
+{
+	char path[256];
+	char data[512];
+
+	snprintf(path, sizeof(path), "%s/%d", root, pid);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/%d/attr", root, pid);
+	mkdir(path, 0755);
+
+	snprintf(path, sizeof(path), "%s/%d/stat", root, pid);
+	snprintf(data, sizeof(data), "%d (task %d) S 1 1 1 0 -1 4194560 0 0 0 "
+		 "0 0 0 0 0 20 0 1 0 %llu 0 0\n", pid, pid, starttime);
+	write_file(path, data);
+
+	snprintf(path, sizeof(path), "%s/%d/attr/current", root, pid);
+	snprintf(data, sizeof(data), "App%llu", starttime);
+	write_file(path, data);
+}
+
+static void remove_process(int pid)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/%d/attr/current", root, pid);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/%d/attr", root, pid);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/%d/stat", root, pid);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/%d", root, pid);
+	rmdir(path);
+}
+
+/* What smack_new_label_from_process() does, on the stand-in tree. */
+static ssize_t uncached_label(int pid, char **label)
+{
+	char path[256];
+	char buf[SMACK_LABEL_LEN + 1];
+	int fd;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%d/attr/current", root, pid);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, SMACK_LABEL_LEN);
+	close(fd);
+	if (ret < 0)
+		return -1;
+	buf[ret] = '\0';
+
+	*label = calloc(ret + 1, 1);
+	if (*label == NULL)
+		return -1;
+	memcpy(*label, buf, ret);
+	return smack_label_length(*label);
+}
+
+int main(int argc, char **argv)
+{
+	struct smack_process_cache *cache;
+	const char *label;
+	char *new_label;
+	char expected[64];
+	int processes = 10000;
+	int rounds = 10;
+	double uncached = 0;
+	double cached = 0;
+	double start;
+	int errors = 0;
+	int pid;
+	int r;
+
+	if (argc > 1)
+		processes = atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+
+	if (mkdtemp(root) == NULL) {
+		perror(root);
+		return 1;
+	}
+
+	for (pid = 1; pid <= processes; pid++)
+		make_process(pid, pid);
+
+	if (smack_process_cache_new(&cache, root)) {
+		perror(root);
+		return 1;
+	}
+
+	for (r = 0; r < rounds; r++) {
+		start = now();
+		for (pid = 1; pid <= processes; pid++) {
+			if (uncached_label(pid, &new_label) < 0)
+				errors++;
+			else
+				free(new_label);
+		}
+		uncached += now() - start;
+
+		start = now();
+		for (pid = 1; pid <= processes; pid++)
+			if (smack_process_cache_get(cache, pid, &label) < 0)
+				errors++;
+		cached += now() - start;
+	}
+
+	printf("%d processes, %d rounds\n", processes, rounds);
+	printf("uncached: %8.2f us/lookup\n", uncached * 1e6 / rounds / processes);
+	printf("cached:   %8.2f us/lookup\n", cached * 1e6 / rounds / processes);
+
+	for (pid = 1; pid <= processes; pid += 2) {
+		remove_process(pid);
+		make_process(pid, pid + processes);
+	}
+	for (pid = 1; pid <= processes; pid++) {
+		snprintf(expected, sizeof(expected), "App%d",
+			 pid % 2 ? pid + processes : pid);
+		if (smack_process_cache_get(cache, pid, &label) < 0 ||
+		    strcmp(label, expected)) {
+			fprintf(stderr, "pid %d: wrong label after reuse\n", pid);
+			errors++;
+		}
+	}
+
+	for (pid = 1; pid <= processes; pid++)
+		remove_process(pid);
+	rmdir(root);
+	smack_process_cache_free(cache);
+
+	if (errors)
+		fprintf(stderr, "%d errors\n", errors);
+	return errors != 0;
+}
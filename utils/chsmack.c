@@ -19,6 +19,8 @@
  * 02110-1301 USA
  */
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/xattr.h>
@@ -33,6 +35,12 @@
 #include <errno.h>
 #include <libgen.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <regex.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include "config.h"
 
@@ -52,11 +60,19 @@ static const char usage[] =
 	" -M --drop-mmap       remove "XATTR_NAME_SMACKMMAP"\n"
 	" -T --drop-transmute  remove "XATTR_NAME_SMACKTRANSMUTE"\n"
 	" -r --recursive       list or modify also files in subdirectories\n"
+	" -u --update          only write attributes whose value differs\n"
+	" -j --jobs N          scan directories with N threads\n"
+	" -o --ordered         with -j, print in the order of a single thread\n"
+	" -S --spec FILE       set the attributes given by the rules of FILE\n"
+	" -F --from-manifest FILE  set the attributes listed in FILE\n"
+	" -O --dump FILE       write the attributes of the tree to FILE\n"
+	" -I --restore FILE    restore the attributes written by --dump\n"
+	" -X --tar             label the entries of a tar stream from stdin\n"
 	"Obsolete option:\n"
 	" -d --remove          tell to remove the attribute\n"
 ;
 
-static const char shortoptions[] = "vha::e::m::tdLDAEMTr";
+static const char shortoptions[] = "vha::e::m::tdLDAEMTruj:oS:F:O:I:X";
 static struct option options[] = {
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
@@ -71,228 +87,1995 @@ static struct option options[] = {
 	{"drop-mmap", no_argument, 0, 'M'},
 	{"drop-transmute", no_argument, 0, 'T'},
 	{"recursive", no_argument, 0, 'r'},
+	{"update", no_argument, 0, 'u'},
+	{"jobs", required_argument, 0, 'j'},
+	{"ordered", no_argument, 0, 'o'},
+	{"spec", required_argument, 0, 'S'},
+	{"from-manifest", required_argument, 0, 'F'},
+	{"dump", required_argument, 0, 'O'},
+	{"restore", required_argument, 0, 'I'},
+	{"tar", no_argument, 0, 'X'},
 	{"remove", no_argument, 0, 'd'},
 	{NULL, 0, 0, 0}
 };
 
-/* enumeration for state of flags */
-enum state {
-	unset    = 0,
-	positive = 1,
-	negative = 2
+/* enumeration for state of flags */
+enum state {
+	unset    = 0,
+	positive = 1,
+	negative = 2
+};
+
+/* structure for recording options of label and their init */
+struct labelset {
+	enum state isset;  /* how is it set */
+	const char *value; /* value of the option set if any or NULL else */
+};
+
+static struct labelset access_set = { unset, NULL }; /* for option "access" */
+static struct labelset exec_set = { unset, NULL }; /* for option "exec" */
+static struct labelset mmap_set = { unset, NULL }; /* for option "mmap" */
+static enum state transmute_flag = unset; /* for option "transmute" */
+static enum state follow_flag = unset; /* for option "dereference" */
+static enum state recursive_flag = unset; /* for option "recursive" */
+static enum state update_flag = unset; /* for option "update" */
+static enum state ordered_flag = unset; /* for option "ordered" */
+static enum state restore_flag = unset; /* for option "restore" */
+static enum state tar_flag = unset; /* for option "tar" */
+static int jobs; /* for option "jobs" */
+
+/* rule of a spec file, applied to the paths matching its expression */
+struct spec_rule {
+	regex_t regex;
+	struct labelset access;
+	struct labelset exec;
+	struct labelset mmap;
+	enum state transmute;
+};
+
+/* trie of the literal prefixes of the expressions of the rules, a path
+ * is only matched against the rules whose prefix it starts with */
+struct spec_trie {
+	char car;
+	struct spec_trie *child;
+	struct spec_trie *next;
+	int *rules;
+	int rules_cnt;
+};
+
+static struct spec_rule *spec_rules; /* for option "spec" */
+static int spec_rules_cnt;
+static struct spec_trie spec_root;
+
+/* file of a manifest with the attributes to set */
+struct manifest_entry {
+	char *path;
+	size_t dir_len; /* length of the directory part of path */
+	const char *name;
+	struct labelset access;
+	struct labelset exec;
+	struct labelset mmap;
+	enum state transmute;
+};
+
+/* lines of a dump, the path and the attributes are separated by a null
+ * character to sort the lines by path */
+struct dump_lines {
+	pthread_mutex_t lock;
+	char **lines;
+	size_t cnt;
+	size_t alloc;
+};
+
+static struct dump_lines dump_lines = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+static long failures; /* count of reported errors */
+
+/* count of attribute operations in flight without jobs */
+#define LABEL_BATCH_DEPTH 256
+
+static struct smack_label_batch *batch; /* for modifications without jobs */
+
+/* Output of the files of one directory, in traversal order. The output of
+ * a subdirectory is a child that takes the place of its entries. */
+struct output {
+	struct output_item *items;
+	size_t cnt;
+	size_t alloc;
+};
+
+struct output_item {
+	FILE *stream; /* stdout or stderr, NULL for a subdirectory */
+	char *text;
+	size_t len;
+	struct output *child;
+};
+
+/* function applied to the file name in directory dirfd, known as path,
+ * type is its DT_* type from the directory or DT_UNKNOWN */
+typedef void (*file_fun)(int dirfd, const char *name, const char *path,
+			 unsigned char type);
+
+/* attribute operation queued in the batch, name and path are copies that
+ * follow the structure */
+struct label_op {
+	int dirfd;
+	int flags;
+	const char *attr;
+	const char *label; /* label to set or NULL to remove it */
+	const char *name;
+	const char *path;
+	char current[SMACK_LABEL_LEN + 1];
+};
+
+/* buffer for the path of the files of a walk */
+struct path_buf {
+	char *buf;
+	size_t size;
+};
+
+/* scanned directory, kept open while its subdirectories are queued */
+struct walk_dir {
+	DIR *dir;
+	int dir_fd;
+	long refs;
+};
+
+/* directory waiting to be scanned, name is relative to the parent or to
+ * the current directory if there is no parent */
+struct walk_task {
+	struct walk_dir *parent;
+	char *path;
+	const char *name;
+	struct output *output;
+};
+
+/* deque of a walk worker, the owner takes from the tail, others steal
+ * from the head */
+struct walk_queue {
+	pthread_mutex_t lock;
+	struct walk_task *tasks;
+	size_t head;
+	size_t tail;
+	size_t alloc;
+};
+
+struct walk {
+	struct walk_queue *queues;
+	int cnt;
+	long pending;
+	int follow;
+	file_fun fun;
+};
+
+/* identity of a file */
+struct inode_key {
+	dev_t dev;
+	ino_t ino;
+};
+
+/* open addressing hash set of the files already visited by the walk, an
+ * empty slot has a null key */
+struct inode_set {
+	pthread_mutex_t lock;
+	struct inode_key *keys;
+	size_t mask;
+	size_t cnt;
+};
+
+static struct inode_set visited = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+/* output of the calling thread or NULL for direct output */
+static __thread struct output *output_current;
+
+static void out_of_memory(void)
+{
+	fprintf(stderr, "error: out of memory.\n");
+	exit(1);
+}
+
+static struct output *output_new(void)
+{
+	struct output *out = calloc(1, sizeof(struct output));
+	if (out == NULL)
+		out_of_memory();
+	return out;
+}
+
+static struct output_item *output_add(struct output *out)
+{
+	struct output_item *items;
+
+	if (out->cnt == out->alloc) {
+		out->alloc = out->alloc ? out->alloc * 2 : 16;
+		items = realloc(out->items,
+				out->alloc * sizeof(struct output_item));
+		if (items == NULL)
+			out_of_memory();
+		out->items = items;
+	}
+	memset(&out->items[out->cnt], 0, sizeof(struct output_item));
+	return &out->items[out->cnt++];
+}
+
+/* write the output tree in order and free it */
+static void output_flush(struct output *out)
+{
+	size_t i;
+
+	for (i = 0; i < out->cnt; i++) {
+		if (out->items[i].child)
+			output_flush(out->items[i].child);
+		else
+			fwrite(out->items[i].text, 1, out->items[i].len,
+			       out->items[i].stream);
+		free(out->items[i].text);
+	}
+	free(out->items);
+	free(out);
+}
+
+/* print a whole line at once, in the output of the thread if ordered */
+static void emit(FILE *stream, const char *fmt, ...)
+{
+	struct output_item *item;
+	char buf[BUFSIZ];
+	char *text = buf;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+
+	if ((size_t)len >= sizeof(buf)) {
+		text = malloc(len + 1);
+		if (text == NULL)
+			out_of_memory();
+		va_start(ap, fmt);
+		vsnprintf(text, len + 1, fmt, ap);
+		va_end(ap);
+	}
+
+	if (output_current == NULL) {
+		fputs(text, stream);
+	} else {
+		item = output_current->cnt ?
+			&output_current->items[output_current->cnt - 1] : NULL;
+		if (item == NULL || item->stream != stream)
+			item = output_add(output_current);
+		item->stream = stream;
+		item->text = realloc(item->text, item->len + len);
+		if (item->text == NULL)
+			out_of_memory();
+		memcpy(item->text + item->len, text, len);
+		item->len += len;
+	}
+
+	if (text != buf)
+		free(text);
+}
+
+/* report the error of errno for path, like perror */
+static void report(const char *path)
+{
+	__atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+	emit(stderr, "%s: %s\n", path, strerror(errno));
+}
+
+static inline size_t inode_hash(dev_t dev, ino_t ino)
+{
+	uint64_t hash = (uint64_t)ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t)dev;
+	return hash ^ (hash >> 29);
+}
+
+/* slot of the key in keys, or of the empty slot where it goes */
+static struct inode_key *inode_slot(struct inode_key *keys, size_t mask,
+				    dev_t dev, ino_t ino)
+{
+	size_t i = inode_hash(dev, ino) & mask;
+
+	while ((keys[i].dev || keys[i].ino) &&
+	       (keys[i].dev != dev || keys[i].ino != ino))
+		i = (i + 1) & mask;
+	return &keys[i];
+}
+
+/* record a visited file, return 1 if it wasn't visited before */
+static int visit(dev_t dev, ino_t ino)
+{
+	struct inode_key *keys;
+	struct inode_key *key;
+	size_t mask;
+	size_t i;
+	int first = 0;
+
+	pthread_mutex_lock(&visited.lock);
+
+	if (2 * (visited.cnt + 1) > visited.mask + 1) {
+		mask = visited.mask ? 2 * visited.mask + 1 : 1023;
+		keys = calloc(mask + 1, sizeof(struct inode_key));
+		if (keys == NULL)
+			out_of_memory();
+		for (i = 0; visited.keys && i <= visited.mask; i++)
+			if (visited.keys[i].dev || visited.keys[i].ino)
+				*inode_slot(keys, mask, visited.keys[i].dev,
+					    visited.keys[i].ino) =
+					visited.keys[i];
+		free(visited.keys);
+		visited.keys = keys;
+		visited.mask = mask;
+	}
+
+	key = inode_slot(visited.keys, visited.mask, dev, ino);
+	if (!key->dev && !key->ino) {
+		key->dev = dev;
+		key->ino = ino;
+		visited.cnt++;
+		first = 1;
+	}
+
+	pthread_mutex_unlock(&visited.lock);
+	return first;
+}
+
+/* get the option for the given char */
+static struct option *option_by_char(int car)
+{
+	struct option *result = options;
+	while (result->name != NULL && result->val != car)
+		result++;
+	return result;
+}
+
+/* flags of the *at functions for the attributes of a file of the given
+ * type, following a file that is not a link changes nothing */
+static inline int at_flags(unsigned char type)
+{
+	if (follow_flag || (type != DT_LNK && type != DT_UNKNOWN))
+		return 0;
+	return AT_SYMLINK_NOFOLLOW;
+}
+
+/* flags of the library *_at functions, which are also told the type so
+ * that they don't have to stat the file */
+static inline int label_flags(unsigned char type)
+{
+	return at_flags(type) | SMACK_AT_DTYPE(type);
+}
+
+/* completion of a queued operation */
+static void label_done(ssize_t result, void *data)
+{
+	struct label_op *op = data;
+
+	if (result < 0 && (op->label != NULL || errno != ENODATA))
+		report(op->path);
+	free(op);
+}
+
+/* completion of the read of the attribute that op only sets if differing */
+static void label_checked(ssize_t result, void *data)
+{
+	struct label_op *op = data;
+	int rc;
+
+	if (result > 0 && !strcmp(op->current, op->label)) {
+		free(op);
+		return;
+	}
+	rc = smack_label_batch_set(batch, op->dirfd, op->name, op->attr,
+				   op->flags, op->label, label_done, op);
+	if (rc < 0) {
+		report(op->path);
+		free(op);
+	}
+}
+
+/* queue the setting (or removal if label is NULL) of an attribute */
+static void queue_label(int dirfd, const char *name, const char *path,
+			int flags, const char *attr, const char *label)
+{
+	size_t name_len = strlen(name) + 1;
+	size_t path_len = strlen(path) + 1;
+	struct label_op *op;
+	char *copy;
+	int rc;
+
+	op = malloc(sizeof(struct label_op) + name_len + path_len);
+	if (op == NULL)
+		out_of_memory();
+	copy = (char *)(op + 1);
+	memcpy(copy, name, name_len);
+	memcpy(copy + name_len, path, path_len);
+	op->dirfd = dirfd;
+	op->flags = flags;
+	op->attr = attr;
+	op->label = label;
+	op->name = copy;
+	op->path = copy + name_len;
+
+	if (label == NULL)
+		rc = smack_label_batch_remove(batch, dirfd, op->name, attr,
+					      flags, label_done, op);
+	else if (update_flag)
+		rc = smack_label_batch_get(batch, dirfd, op->name, attr, flags,
+					   op->current, label_checked, op);
+	else
+		rc = smack_label_batch_set(batch, dirfd, op->name, attr, flags,
+					   label, label_done, op);
+	if (rc < 0) {
+		report(path);
+		free(op);
+	}
+}
+
+/* set an attribute of a file, if requested only when it differs */
+static int set_label(int dirfd, const char *name, const char *attr,
+		     int flags, const char *label)
+{
+	if (update_flag)
+		return smack_update_label_for_path_at(dirfd, name, attr,
+						      flags, label);
+	return smack_set_label_for_path_at(dirfd, name, attr, flags, label);
+}
+
+/* modify attributes of a file */
+static void modify_prop(int dirfd, const char *name, const char *path,
+			unsigned char type, struct labelset *ls,
+			const char *attr)
+{
+	int rc;
+	if (batch != NULL && ls->isset != unset) {
+		queue_label(dirfd, name, path, label_flags(type), attr,
+			    ls->isset == positive ? ls->value : NULL);
+		return;
+	}
+	switch (ls->isset) {
+	case positive:
+		rc = set_label(dirfd, name, attr, label_flags(type), ls->value);
+		if (rc < 0)
+			report(path);
+		break;
+	case negative:
+		rc = smack_remove_label_for_path_at(dirfd, name, attr,
+						    label_flags(type));
+		if (rc < 0 && errno != ENODATA)
+			report(path);
+		break;
+	}
+}
+
+/* whether the type of a directory entry must be read with a stat, that
+ * is unknown or hidden behind a followed link */
+static inline int type_unknown(unsigned char type)
+{
+	return type == DT_UNKNOWN || (type == DT_LNK && follow_flag);
+}
+
+/* modify transmutation of a directory */
+static void modify_transmute(int dirfd, const char *name, const char *path,
+			     unsigned char type, enum state transmute)
+{
+	struct stat st;
+	int rc;
+	switch (transmute) {
+	case positive:
+		rc = 0;
+		if (type_unknown(type)) {
+			rc = fstatat(dirfd, name, &st, at_flags(type));
+			if (rc == 0)
+				type = IFTODT(st.st_mode);
+		}
+		if (rc < 0)
+			report(path);
+		else if (type != DT_DIR) {
+			if (!recursive_flag) {
+				emit(stderr,
+				     "%s: transmute: not a directory\n",
+				     path);
+			}
+		} else if (batch != NULL) {
+			queue_label(dirfd, name, path, label_flags(type),
+				    XATTR_NAME_SMACKTRANSMUTE, "TRUE");
+		} else {
+			rc = set_label(dirfd, name, XATTR_NAME_SMACKTRANSMUTE,
+				       label_flags(type), "TRUE");
+			if (rc < 0)
+				report(path);
+		}
+		break;
+	case negative:
+		if (batch != NULL) {
+			queue_label(dirfd, name, path, label_flags(type),
+				    XATTR_NAME_SMACKTRANSMUTE, NULL);
+			break;
+		}
+		rc = smack_remove_label_for_path_at(dirfd, name,
+						    XATTR_NAME_SMACKTRANSMUTE,
+						    label_flags(type));
+		if (rc < 0 && errno != ENODATA)
+			report(path);
+		break;
+	}
+}
+
+/* whether the file name in dirfd is seen for the first time, only regular
+ * files with several links can be seen again, directories are checked
+ * when scanned. An unknown type is set from the stat. */
+static int first_link(int dirfd, const char *name, unsigned char *type)
+{
+	struct stat st;
+
+	if (*type != DT_REG && !type_unknown(*type))
+		return 1;
+	/* on failure, the error is reported by the operations */
+	if (fstatat(dirfd, name, &st, at_flags(*type)) < 0)
+		return 1;
+	*type = IFTODT(st.st_mode);
+	if (!S_ISREG(st.st_mode) || st.st_nlink < 2)
+		return 1;
+	return visit(st.st_dev, st.st_ino);
+}
+
+/* modify the file (or directory) name in dirfd, known as path */
+static void modify_file(int dirfd, const char *name, const char *path,
+			unsigned char type)
+{
+	if (!first_link(dirfd, name, &type))
+		return;
+	modify_prop(dirfd, name, path, type, &access_set, XATTR_NAME_SMACK);
+	modify_prop(dirfd, name, path, type, &exec_set, XATTR_NAME_SMACKEXEC);
+	modify_prop(dirfd, name, path, type, &mmap_set, XATTR_NAME_SMACKMMAP);
+	modify_transmute(dirfd, name, path, type, transmute_flag);
+}
+
+/* length of the literal text an extended regular expression starts with */
+static size_t spec_prefix(const char *expr, char *prefix)
+{
+	size_t len = 0;
+	size_t i;
+
+	/* a top level alternative may start with anything */
+	for (i = 0; expr[i]; i++) {
+		if (expr[i] == '\\' && expr[i + 1])
+			i++;
+		else if (expr[i] == '|')
+			return 0;
+	}
+
+	for (i = 0; expr[i] && len < PATH_MAX; i++) {
+		if (strchr(".[]()*+?{}|^$", expr[i]))
+			break;
+		if (expr[i] == '\\') {
+			if (!expr[i + 1] || strchr("<>bBwWsS`'", expr[i + 1]) ||
+			    (expr[i + 1] >= '0' && expr[i + 1] <= '9'))
+				break;
+			i++;
+		}
+		prefix[len++] = expr[i];
+	}
+
+	/* the last character is optional or repeated */
+	if (len && expr[i] && strchr("*+?{", expr[i]))
+		len--;
+
+	return len;
+}
+
+static void spec_trie_add(const char *prefix, size_t len, int rule)
+{
+	struct spec_trie *node = &spec_root;
+	struct spec_trie **link;
+	int *rules;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		link = &node->child;
+		while (*link && (*link)->car != prefix[i])
+			link = &(*link)->next;
+		if (*link == NULL) {
+			*link = calloc(1, sizeof(struct spec_trie));
+			if (*link == NULL)
+				out_of_memory();
+			(*link)->car = prefix[i];
+		}
+		node = *link;
+	}
+
+	rules = realloc(node->rules, (node->rules_cnt + 1) * sizeof(int));
+	if (rules == NULL)
+		out_of_memory();
+	rules[node->rules_cnt++] = rule;
+	node->rules = rules;
+}
+
+static struct spec_trie *spec_trie_child(struct spec_trie *node, char car)
+{
+	for (node = node->child; node && node->car != car; node = node->next)
+		;
+	return node;
+}
+
+/* the form of a path the rules of a spec match: without its leading "/"
+ * and "./", so that a walked path and a member of a tar archive match the
+ * same way. The top directory "." is the empty path. */
+static const char *spec_path(const char *path)
+{
+	while (path[0] == '/' || (path[0] == '.' && path[1] == '/'))
+		path += path[0] == '/' ? 1 : 2;
+	return strcmp(path, ".") ? path : "";
+}
+
+/* the rule of the spec for the path: the last one that matches */
+static struct spec_rule *spec_match(const char *path)
+{
+	struct spec_trie *node = &spec_root;
+	const char *car;
+	int best = -1;
+	int i;
+
+	path = spec_path(path);
+	car = path;
+
+	while (node) {
+		for (i = 0; i < node->rules_cnt; i++)
+			if (node->rules[i] > best &&
+			    !regexec(&spec_rules[node->rules[i]].regex, path,
+				     0, NULL, 0))
+				best = node->rules[i];
+		node = *car ? spec_trie_child(node, *car++) : NULL;
+	}
+
+	return best < 0 ? NULL : &spec_rules[best];
+}
+
+/* whether a rule of the spec may match files below the directory path */
+static int spec_descend(const char *path)
+{
+	struct spec_trie *node = &spec_root;
+
+	path = spec_path(path);
+	if (!*path)
+		return 1;
+	for (; *path; path++) {
+		if (node->rules_cnt)
+			return 1;
+		node = spec_trie_child(node, *path);
+		if (node == NULL)
+			return 0;
+	}
+	return node->rules_cnt || spec_trie_child(node, '/');
+}
+
+/* parse the label of an attribute of a spec rule, quotes are optional */
+static int spec_label(char *value, const char **label)
+{
+	size_t len = strlen(value);
+
+	if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+		value[len - 1] = '\0';
+		value++;
+	}
+	if (smack_label_length(value) < 0)
+		return -1;
+	*label = value;
+	return 0;
+}
+
+/* read the rules of a spec file, a rule is an extended regular expression
+ * matching a whole path and the attributes to set on matching files */
+static void spec_load(const char *spec)
+{
+	struct spec_rule *rule;
+	char prefix[PATH_MAX];
+	char *line = NULL;
+	size_t line_size = 0;
+	char *expr, *anchored, *attr, *value, *save;
+	int line_num = 0;
+	FILE *file;
+	int rc;
+
+	file = strcmp(spec, "-") ? fopen(spec, "r") : stdin;
+	if (file == NULL) {
+		perror(spec);
+		exit(1);
+	}
+
+	while (getline(&line, &line_size, file) != -1) {
+		line_num++;
+		expr = strtok_r(line, " \t\n", &save);
+		if (expr == NULL || expr[0] == '#')
+			continue;
+
+		rule = realloc(spec_rules,
+			       (spec_rules_cnt + 1) * sizeof(struct spec_rule));
+		if (rule == NULL)
+			out_of_memory();
+		spec_rules = rule;
+		rule = &spec_rules[spec_rules_cnt];
+		memset(rule, 0, sizeof(struct spec_rule));
+
+		anchored = malloc(strlen(expr) + 5);
+		if (anchored == NULL)
+			out_of_memory();
+		sprintf(anchored, "^(%s)$", expr);
+		rc = regcomp(&rule->regex, anchored, REG_EXTENDED | REG_NOSUB);
+		free(anchored);
+		if (rc) {
+			fprintf(stderr, "%s:%d: invalid expression '%s'.\n",
+				spec, line_num, expr);
+			exit(1);
+		}
+
+		while ((attr = strtok_r(NULL, " \t\n", &save)) != NULL) {
+			value = strchr(attr, '=');
+			if (value)
+				*value++ = '\0';
+
+			if (!strcmp(attr, "transmute") &&
+			    (!value || !strcmp(value, "TRUE") ||
+			     !strcmp(value, "\"TRUE\""))) {
+				rule->transmute = positive;
+				continue;
+			}
+			if (value == NULL)
+				rc = -1;
+			else if (!strcmp(attr, "access"))
+				rc = spec_label(value, &rule->access.value);
+			else if (!strcmp(attr, "execute") ||
+				 !strcmp(attr, "exec"))
+				rc = spec_label(value, &rule->exec.value);
+			else if (!strcmp(attr, "mmap"))
+				rc = spec_label(value, &rule->mmap.value);
+			else
+				rc = -1;
+			if (rc) {
+				fprintf(stderr, "%s:%d: invalid attribute "
+					"'%s'.\n", spec, line_num, attr);
+				exit(1);
+			}
+		}
+
+		/* labels point into the line, keep it */
+		rule->access.isset = rule->access.value ? positive : unset;
+		rule->exec.isset = rule->exec.value ? positive : unset;
+		rule->mmap.isset = rule->mmap.value ? positive : unset;
+		spec_trie_add(prefix, spec_prefix(expr, prefix),
+			      spec_rules_cnt++);
+		line = NULL;
+		line_size = 0;
+	}
+
+	free(line);
+	if (file != stdin)
+		fclose(file);
+}
+
+/* set the attributes of the spec rule matching the file */
+static void spec_file(int dirfd, const char *name, const char *path,
+		      unsigned char type)
+{
+	struct spec_rule *rule = spec_match(path);
+
+	if (rule == NULL)
+		return;
+	modify_prop(dirfd, name, path, type, &rule->access, XATTR_NAME_SMACK);
+	modify_prop(dirfd, name, path, type, &rule->exec, XATTR_NAME_SMACKEXEC);
+	modify_prop(dirfd, name, path, type, &rule->mmap, XATTR_NAME_SMACKMMAP);
+	modify_transmute(dirfd, name, path, type, rule->transmute);
+}
+
+/* last occurence of car in the text before end, or NULL */
+static char *find_last(char *text, char car, char *end)
+{
+	while (end > text)
+		if (*--end == car)
+			return end;
+	return NULL;
+}
+
+/* whether the character of a path is written as an octal escape in a
+ * manifest: it would end the line or be taken for an attribute */
+static inline int path_escaped(unsigned char car)
+{
+	return car < ' ' || car == 0x7f || car == '\\' || car == '"';
+}
+
+/* copy path to buf with the characters path_escaped() selects written as
+ * \ooo, buf holds 4 * strlen(path) + 1 characters; return the length */
+static size_t escape_path(const char *path, char *buf)
+{
+	const unsigned char *p = (const unsigned char *)path;
+	char *out = buf;
+
+	for (; *p; p++)
+		if (path_escaped(*p))
+			out += sprintf(out, "\\%03o", *p);
+		else
+			*out++ = *p;
+	*out = '\0';
+	return out - buf;
+}
+
+/* decode in place the \ooo escapes written by escape_path(), a backslash
+ * not followed by three octal digits is kept as is */
+static void unescape_path(char *path)
+{
+	char *in = path, *out = path;
+
+	while (*in) {
+		if (in[0] == '\\' && in[1] >= '0' && in[1] <= '3' &&
+		    in[2] >= '0' && in[2] <= '7' &&
+		    in[3] >= '0' && in[3] <= '7') {
+			*out++ = (in[1] - '0') << 6 | (in[2] - '0') << 3 |
+				 (in[3] - '0');
+			in += 4;
+		} else {
+			*out++ = *in++;
+		}
+	}
+	*out = '\0';
+}
+
+/* parse a line of a manifest, as printed by chsmack: the path followed by
+ * the attributes. Labels have no spaces nor quotes, so the attributes are
+ * taken from the end of the line and the path may contain spaces; quotes,
+ * backslashes and control characters of the path are octal escapes. */
+static int manifest_parse(char *line, struct manifest_entry *entry)
+{
+	char *end = line + strlen(line);
+	char *quote, *key;
+	struct labelset *ls;
+	char *slash;
+
+	memset(entry, 0, sizeof(struct manifest_entry));
+	while (end > line && end[-1] == '\n')
+		*--end = '\0';
+
+	while (end > line && end[-1] == '"') {
+		quote = find_last(line, '"', end - 1);
+		if (quote == NULL || quote - line < 2 || quote[-1] != '=')
+			break;
+		key = find_last(line, ' ', quote);
+		if (key == NULL)
+			break;
+
+		quote[-1] = '\0';
+		end[-1] = '\0';
+		if (!strcmp(key + 1, "access"))
+			ls = &entry->access;
+		else if (!strcmp(key + 1, "execute"))
+			ls = &entry->exec;
+		else if (!strcmp(key + 1, "mmap"))
+			ls = &entry->mmap;
+		else if (!strcmp(key + 1, "transmute") &&
+			 !strcmp(quote + 1, "TRUE"))
+			ls = NULL;
+		else
+			return -1;
+
+		if (ls == NULL) {
+			entry->transmute = positive;
+		} else {
+			if (smack_label_length(quote + 1) < 0)
+				return -1;
+			ls->isset = positive;
+			ls->value = quote + 1;
+		}
+		*key = '\0';
+		end = key;
+	}
+
+	if (end == line)
+		return -1;
+
+	unescape_path(line);
+	if (line[0] == '\0')
+		return -1;
+	entry->path = line;
+	slash = strrchr(line, '/');
+	if (slash == NULL) {
+		entry->dir_len = 0;
+		entry->name = line;
+	} else {
+		entry->dir_len = slash == line ? 1 : (size_t)(slash - line);
+		entry->name = slash[1] ? slash + 1 : ".";
+	}
+	return 0;
+}
+
+/* order entries by directory */
+static int manifest_cmp_dir(const struct manifest_entry *ea,
+			    const struct manifest_entry *eb)
+{
+	size_t len = ea->dir_len < eb->dir_len ? ea->dir_len : eb->dir_len;
+	int rc;
+
+	rc = memcmp(ea->path, eb->path, len);
+	if (rc)
+		return rc;
+	if (ea->dir_len != eb->dir_len)
+		return ea->dir_len < eb->dir_len ? -1 : 1;
+	return 0;
+}
+
+/* order entries by directory, then by name */
+static int manifest_cmp(const void *a, const void *b)
+{
+	const struct manifest_entry *ea = a;
+	const struct manifest_entry *eb = b;
+	int rc;
+
+	rc = manifest_cmp_dir(ea, eb);
+	return rc ? rc : strcmp(ea->name, eb->name);
+}
+
+/* count of directories of a manifest kept open for the queued operations */
+#define MANIFEST_OPEN_DIRS 64
+
+/* keep in ls only the change from the current label, an attribute not
+ * listed in a dump is removed */
+static void label_change(struct labelset *ls, const char *current)
+{
+	if (ls->isset == unset)
+		ls->isset = negative;
+	if ((ls->isset == positive && !strcmp(ls->value, current)) ||
+	    (ls->isset == negative && !current[0]))
+		ls->isset = unset;
+}
+
+/* keep in the entry of a dump only the changes from the file */
+static int restore_changes(int dirfd, struct manifest_entry *entry)
+{
+	struct smack_file_labels labels;
+
+	if (smack_get_file_labels_at(dirfd, entry->name,
+				     at_flags(DT_UNKNOWN), &labels) < 0)
+		return -1;
+
+	label_change(&entry->access, labels.access);
+	label_change(&entry->exec, labels.exec);
+	label_change(&entry->mmap, labels.mmap);
+	if (entry->transmute == unset)
+		entry->transmute = negative;
+	if ((entry->transmute == positive) == (labels.transmute[0] != '\0'))
+		entry->transmute = unset;
+	return 0;
+}
+
+/* set the attributes listed in a manifest, directory by directory, and
+ * when restoring remove the attributes not listed */
+static void manifest_apply(const char *manifest)
+{
+	struct manifest_entry *entries = NULL;
+	struct manifest_entry *entry;
+	size_t cnt = 0, alloc = 0, i, j;
+	char *line = NULL;
+	size_t line_size = 0;
+	int line_num = 0;
+	FILE *file;
+	char *dir;
+	int fds[MANIFEST_OPEN_DIRS];
+	int fds_cnt = 0;
+	int fd;
+
+	file = strcmp(manifest, "-") ? fopen(manifest, "r") : stdin;
+	if (file == NULL) {
+		perror(manifest);
+		exit(1);
+	}
+
+	while (getline(&line, &line_size, file) != -1) {
+		line_num++;
+		if (cnt == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			entry = realloc(entries,
+					alloc * sizeof(struct manifest_entry));
+			if (entry == NULL)
+				out_of_memory();
+			entries = entry;
+		}
+		if (manifest_parse(line, &entries[cnt])) {
+			fprintf(stderr, "%s:%d: invalid entry.\n", manifest,
+				line_num);
+			failures++;
+			continue;
+		}
+		cnt++;
+		line = NULL;
+		line_size = 0;
+	}
+	free(line);
+	if (file != stdin)
+		fclose(file);
+
+	qsort(entries, cnt, sizeof(struct manifest_entry), manifest_cmp);
+
+	for (i = 0; i < cnt; i = j) {
+		for (j = i + 1; j < cnt && !manifest_cmp_dir(&entries[i],
+							      &entries[j]); j++)
+			;
+
+		fd = AT_FDCWD;
+		if (entries[i].dir_len) {
+			dir = strndup(entries[i].path, entries[i].dir_len);
+			if (dir == NULL)
+				out_of_memory();
+			fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			free(dir);
+		}
+
+		for (; i < j; i++) {
+			entry = &entries[i];
+			if ((fd < 0 && fd != AT_FDCWD) ||
+			    (restore_flag && restore_changes(fd, entry) < 0)) {
+				report(entry->path);
+				continue;
+			}
+			modify_prop(fd, entry->name, entry->path, DT_UNKNOWN,
+				    &entry->access, XATTR_NAME_SMACK);
+			modify_prop(fd, entry->name, entry->path, DT_UNKNOWN,
+				    &entry->exec, XATTR_NAME_SMACKEXEC);
+			modify_prop(fd, entry->name, entry->path, DT_UNKNOWN,
+				    &entry->mmap, XATTR_NAME_SMACKMMAP);
+			modify_transmute(fd, entry->name, entry->path,
+					 DT_UNKNOWN, entry->transmute);
+		}
+
+		/* queued operations use the directory until flushed */
+		if (fd >= 0)
+			fds[fds_cnt++] = fd;
+		if (fds_cnt == MANIFEST_OPEN_DIRS || j == cnt) {
+			if (batch != NULL)
+				smack_label_batch_flush(batch);
+			while (fds_cnt)
+				close(fds[--fds_cnt]);
+		}
+	}
+
+	for (i = 0; i < cnt; i++)
+		free(entries[i].path);
+	free(entries);
+}
+
+/* size of the attributes of a file formatted by format_labels */
+#define ATTRS_SIZE (4 * (SMACK_LABEL_LEN + 16))
+
+/* format the attributes of a file as printed, return the length */
+static int format_labels(const struct smack_file_labels *labels,
+			 char *attrs)
+{
+	int len = 0;
+
+	attrs[0] = '\0';
+	if (labels->access[0])
+		len += sprintf(attrs + len, " access=\"%s\"", labels->access);
+	if (labels->exec[0])
+		len += sprintf(attrs + len, " execute=\"%s\"", labels->exec);
+	if (labels->mmap[0])
+		len += sprintf(attrs + len, " mmap=\"%s\"", labels->mmap);
+	if (labels->transmute[0])
+		len += sprintf(attrs + len, " transmute=\"%s\"",
+			       labels->transmute);
+	return len;
+}
+
+/* print the file (or directory) name in dirfd, known as path */
+static void print_file(int dirfd, const char *name, const char *path,
+		       unsigned char type)
+{
+	struct smack_file_labels labels;
+	char attrs[ATTRS_SIZE];
+	int rc;
+
+	rc = smack_get_file_labels_at(dirfd, name, label_flags(type), &labels);
+	if (rc <= 0) {
+		emit(stdout, "%s: No smack property found\n", path);
+		return;
+	}
+
+	format_labels(&labels, attrs);
+
+	/* Print file path and its attributes in one go. */
+	emit(stdout, "%s%s\n", path, attrs);
+}
+
+/* whether a label matches the option given with --dump */
+static int label_match(const struct labelset *ls, const char *label)
+{
+	switch (ls->isset) {
+	case positive:
+		return !strcmp(ls->value, label);
+	case negative:
+		return !label[0];
+	default:
+		return 1;
+	}
+}
+
+/* record the file name in dirfd, known as path, in the dump if its
+ * attributes match the options */
+static void dump_file(int dirfd, const char *name, const char *path,
+		      unsigned char type)
+{
+	struct smack_file_labels labels;
+	char attrs[ATTRS_SIZE];
+	size_t path_len;
+	char **lines;
+	char *line;
+	int len;
+
+	if (smack_get_file_labels_at(dirfd, name, label_flags(type),
+				     &labels) < 0) {
+		report(path);
+		return;
+	}
+
+	if (!label_match(&access_set, labels.access) ||
+	    !label_match(&exec_set, labels.exec) ||
+	    !label_match(&mmap_set, labels.mmap) ||
+	    (transmute_flag == positive && !labels.transmute[0]) ||
+	    (transmute_flag == negative && labels.transmute[0]))
+		return;
+
+	len = format_labels(&labels, attrs);
+	line = malloc(4 * strlen(path) + 1 + len + 1);
+	if (line == NULL)
+		out_of_memory();
+	path_len = escape_path(path, line);
+	memcpy(line + path_len + 1, attrs, len + 1);
+
+	pthread_mutex_lock(&dump_lines.lock);
+	if (dump_lines.cnt == dump_lines.alloc) {
+		dump_lines.alloc = dump_lines.alloc ?
+			dump_lines.alloc * 2 : 4096;
+		lines = realloc(dump_lines.lines,
+				dump_lines.alloc * sizeof(char *));
+		if (lines == NULL)
+			out_of_memory();
+		dump_lines.lines = lines;
+	}
+	dump_lines.lines[dump_lines.cnt++] = line;
+	pthread_mutex_unlock(&dump_lines.lock);
+}
+
+static int dump_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* write the dump sorted by path */
+static void dump_write(const char *dump)
+{
+	FILE *file;
+	size_t i;
+	char *line;
+
+	file = strcmp(dump, "-") ? fopen(dump, "w") : stdout;
+	if (file == NULL) {
+		perror(dump);
+		exit(1);
+	}
+
+	qsort(dump_lines.lines, dump_lines.cnt, sizeof(char *), dump_cmp);
+	for (i = 0; i < dump_lines.cnt; i++) {
+		line = dump_lines.lines[i];
+		fputs(line, file);
+		fputs(line + strlen(line) + 1, file);
+		putc('\n', file);
+		free(line);
+	}
+	free(dump_lines.lines);
+
+	if (fflush(file) || ferror(file) || (file != stdout && fclose(file))) {
+		perror(dump);
+		exit(1);
+	}
+}
+
+/* block of a tar stream */
+#define TAR_BLOCK 512
+
+/* largest pax extended header read */
+#define TAR_PAX_MAX (1 << 24)
+
+/* offsets of the fields of a tar header */
+#define TAR_NAME 0
+#define TAR_MODE 100
+#define TAR_SIZE 124
+#define TAR_CHKSUM 148
+#define TAR_TYPE 156
+#define TAR_MAGIC 257
+#define TAR_PREFIX 345
+
+/* attributes as named in pax headers, in the order of tar_state */
+static const char *const tar_attrs[] = {
+	XATTR_NAME_SMACK,
+	XATTR_NAME_SMACKEXEC,
+	XATTR_NAME_SMACKMMAP,
+	XATTR_NAME_SMACKTRANSMUTE,
 };
 
-/* structure for recording options of label and their init */
-struct labelset {
-	enum state isset;  /* how is it set */
-	const char *value; /* value of the option set if any or NULL else */
+/* growing buffer of output or of a header */
+struct tar_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
 };
 
-static struct labelset access_set = { unset, NULL }; /* for option "access" */
-static struct labelset exec_set = { unset, NULL }; /* for option "exec" */
-static struct labelset mmap_set = { unset, NULL }; /* for option "mmap" */
-static enum state transmute_flag = unset; /* for option "transmute" */
-static enum state follow_flag = unset; /* for option "dereference" */
-static enum state recursive_flag = unset; /* for option "recursive" */
+static int tar_splice = 1; /* whether splice works on the stream */
 
-/* get the option for the given char */
-static struct option *option_by_char(int car)
+static void tar_fail(const char *msg)
 {
-	struct option *result = options;
-	while (result->name != NULL && result->val != car)
-		result++;
-	return result;
+	if (msg)
+		fprintf(stderr, "tar: %s.\n", msg);
+	else
+		perror("tar");
+	exit(1);
 }
 
-/* modify attributes of a file */
-static void modify_prop(const char *path, struct labelset *ls, const char *attr)
+static void tar_append(struct tar_buf *tb, const char *data, size_t len)
 {
-	int rc;
-	switch (ls->isset) {
-	case positive:
-		rc = smack_set_label_for_path(path, attr, follow_flag,
-					      ls->value);
-		if (rc < 0)
-			perror(path);
-		break;
-	case negative:
-		rc = smack_remove_label_for_path(path, attr, follow_flag);
-		if (rc < 0 && errno != ENODATA)
-			perror(path);
-		break;
+	char *tmp;
+
+	if (tb->len + len > tb->alloc) {
+		tb->alloc = tb->len + len + 4096;
+		tmp = realloc(tb->data, tb->alloc);
+		if (tmp == NULL)
+			out_of_memory();
+		tb->data = tmp;
 	}
+	memcpy(tb->data + tb->len, data, len);
+	tb->len += len;
 }
 
-/* modify transmutation of a directory */
-static void modify_transmute(const char *path)
+/* read len bytes of the stream, return 0 at its end before any byte */
+static int tar_read(char *buf, size_t len)
 {
-	struct stat st;
-	int rc;
-	switch (transmute_flag) {
-	case positive:
-		rc = follow_flag ? stat(path, &st) : lstat(path, &st);
-		if (rc < 0)
-			perror(path);
-		else if (!S_ISDIR(st.st_mode)) {
-			if (!recursive_flag) {
-				fprintf(stderr,
-					"%s: transmute: not a directory\n",
-					path);
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = read(STDIN_FILENO, buf + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			tar_fail(NULL);
+		if (n == 0) {
+			if (done == 0)
+				return 0;
+			tar_fail("unexpected end of stream");
+		}
+		done += n;
+	}
+	return 1;
+}
+
+static void tar_write(const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(STDOUT_FILENO, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			tar_fail(NULL);
+		buf += n;
+		len -= n;
+	}
+}
+
+/* copy len bytes of the stream, or up to its end if len is -1, without
+ * going through user space when one side is a pipe */
+static void tar_copy(unsigned long long len)
+{
+	char buf[65536];
+	size_t chunk;
+	ssize_t n;
+
+	while (len) {
+		chunk = len < sizeof(buf) ? len : sizeof(buf);
+		if (tar_splice) {
+			n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL,
+				   len < (1 << 30) ? len : (1 << 30),
+				   SPLICE_F_MOVE);
+			if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				tar_splice = 0;
+				continue;
 			}
 		} else {
-			rc = smack_set_label_for_path(path,
-						      XATTR_NAME_SMACKTRANSMUTE,
-						      follow_flag, "TRUE");
-			if (rc < 0)
-				perror(path);
+			n = read(STDIN_FILENO, buf, chunk);
+			if (n > 0)
+				tar_write(buf, n);
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			tar_fail(NULL);
+		if (n == 0) {
+			if (len == (unsigned long long)-1)
+				return;
+			tar_fail("unexpected end of stream");
+		}
+		if (len != (unsigned long long)-1)
+			len -= n;
+	}
+}
+
+/* value of a numeric field, octal or base-256 */
+static unsigned long long tar_number(const char *field, size_t len)
+{
+	unsigned long long value = 0;
+	size_t i = 0;
+
+	if ((unsigned char)field[0] & 0x80) {
+		value = (unsigned char)field[0] & 0x3f;
+		for (i = 1; i < len; i++)
+			value = value << 8 | (unsigned char)field[i];
+		return value;
+	}
+
+	while (i < len && field[i] == ' ')
+		i++;
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+		value = value << 3 | (field[i] - '0');
+	return value;
+}
+
+static inline unsigned long long tar_padded(unsigned long long len)
+{
+	return (len + TAR_BLOCK - 1) & ~(unsigned long long)(TAR_BLOCK - 1);
+}
+
+/* whether the header has a valid checksum, unsigned or signed */
+static int tar_check(const char *header)
+{
+	unsigned long sum = 0;
+	long ssum = 0;
+	unsigned long want;
+	int i;
+
+	for (i = 0; i < TAR_BLOCK; i++) {
+		if (i >= TAR_CHKSUM && i < TAR_CHKSUM + 8) {
+			sum += ' ';
+			ssum += ' ';
+		} else {
+			sum += (unsigned char)header[i];
+			ssum += (signed char)header[i];
 		}
-		break;
-	case negative:
-		rc = smack_remove_label_for_path(path,
-						 XATTR_NAME_SMACKTRANSMUTE,
-						 follow_flag);
-		if (rc < 0 && errno != ENODATA)
-			perror(path);
-		break;
 	}
+	want = tar_number(header + TAR_CHKSUM, 8);
+	return want == sum || (long)want == ssum;
 }
 
-/* modify the file (or directory) of path */
-static void modify_file(const char *path)
+/* read the data of the entry of header */
+static char *tar_data(const char *header, size_t *len)
 {
-	modify_prop(path, &access_set, XATTR_NAME_SMACK);
-	modify_prop(path, &exec_set, XATTR_NAME_SMACKEXEC);
-	modify_prop(path, &mmap_set, XATTR_NAME_SMACKMMAP);
-	modify_transmute(path);
+	unsigned long long size = tar_number(header + TAR_SIZE, 12);
+	char *data;
+
+	if (size > TAR_PAX_MAX)
+		tar_fail("extended header too large");
+	data = malloc(tar_padded(size) + 1);
+	if (data == NULL)
+		out_of_memory();
+	if (size && !tar_read(data, tar_padded(size)))
+		tar_fail("unexpected end of stream");
+	data[size] = '\0';
+	*len = size;
+	return data;
 }
 
-/* print the file (or directory) of path */
-static void print_file(const char *path)
+/* next record of pax data, return its length or 0 at end or if invalid */
+static size_t tar_record(const char *data, size_t len, const char **key,
+			 size_t *key_len, const char **value,
+			 size_t *value_len)
 {
-	ssize_t rc;
-	char *label;
-	int has_some_smack = 0;
+	size_t rec_len = 0;
+	const char *eq;
+	size_t i;
+
+	for (i = 0; i < len && data[i] >= '0' && data[i] <= '9'; i++)
+		rec_len = rec_len * 10 + (data[i] - '0');
+	if (i == len || data[i] != ' ' || rec_len <= i + 1 || rec_len > len ||
+	    data[rec_len - 1] != '\n')
+		return 0;
 
-	/* Print file path. */
-	printf("%s", path);
+	*key = data + i + 1;
+	eq = memchr(*key, '=', data + rec_len - *key);
+	if (eq == NULL)
+		return 0;
+	*key_len = eq - *key;
+	*value = eq + 1;
+	*value_len = data + rec_len - 1 - *value;
+	return rec_len;
+}
+
+/* attribute of tar_attrs held by an xattr record key, or -1 */
+static int tar_attr(const char *key, size_t key_len)
+{
+	static const char *const prefixes[] = {
+		"SCHILY.xattr.", "LIBARCHIVE.xattr."
+	};
+	size_t len;
+	int i, j;
 
-	errno = 0;
-	rc = smack_new_label_from_path(path, XATTR_NAME_SMACK, follow_flag,
-				       &label);
-	if (rc > 0) {
-		printf(" access=\"%s\"", label);
-		free(label);
-		has_some_smack = 1;
+	for (i = 0; i < 2; i++) {
+		len = strlen(prefixes[i]);
+		if (key_len <= len || memcmp(key, prefixes[i], len))
+			continue;
+		for (j = 0; j < 4; j++)
+			if (key_len - len == strlen(tar_attrs[j]) &&
+			    !memcmp(key + len, tar_attrs[j], key_len - len))
+				return j;
 	}
+	return -1;
+}
+
+/* append a record to pax data */
+static void tar_add_record(struct tar_buf *tb, const char *key,
+			   size_t key_len, const char *value,
+			   size_t value_len)
+{
+	size_t len = key_len + value_len + 3;
+	size_t digits = 1;
+	char num[24];
+
+	/* the length counts its own digits */
+	while (snprintf(num, sizeof(num), "%zu", len + digits) > (int)digits)
+		digits++;
+	snprintf(num, sizeof(num), "%zu ", len + digits);
+	tar_append(tb, num, digits + 1);
+	tar_append(tb, key, key_len);
+	tar_append(tb, "=", 1);
+	tar_append(tb, value, value_len);
+	tar_append(tb, "\n", 1);
+}
+
+/* write a pax extended header with the given records for path */
+static void tar_write_pax(const char *path, const struct tar_buf *records)
+{
+	static const char zeros[TAR_BLOCK];
+	char header[TAR_BLOCK];
+	const char *base = strrchr(path, '/');
+	unsigned long sum = 0;
+	int i;
 
-	rc = smack_new_label_from_path(path, XATTR_NAME_SMACKEXEC, follow_flag,
-				       &label);
-	if (rc > 0) {
-		printf(" execute=\"%s\"", label);
-		free(label);
-		has_some_smack = 1;
+	base = base && base[1] ? base + 1 : path;
+	memset(header, 0, sizeof(header));
+	snprintf(header + TAR_NAME, 100, "PaxHeaders/%s", base);
+	memcpy(header + TAR_MODE, "0000644", 8);
+	memcpy(header + 108, "0000000", 8);
+	memcpy(header + 116, "0000000", 8);
+	snprintf(header + TAR_SIZE, 12, "%011llo",
+		 (unsigned long long)records->len);
+	memcpy(header + 136, "00000000000", 12);
+	header[TAR_TYPE] = 'x';
+	memcpy(header + TAR_MAGIC, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	memset(header + TAR_CHKSUM, ' ', 8);
+	for (i = 0; i < TAR_BLOCK; i++)
+		sum += (unsigned char)header[i];
+	snprintf(header + TAR_CHKSUM, 8, "%06lo", sum);
+
+	tar_write(header, TAR_BLOCK);
+	tar_write(records->data, records->len);
+	tar_write(zeros, tar_padded(records->len) - records->len);
+}
+
+/* write the pax header of the entry of header with its attributes set,
+ * pax holds the records read before the entry, return the size of the
+ * data of the entry */
+static unsigned long long tar_label(const char *header, const char *pax,
+				    size_t pax_len, const char *longname)
+{
+	struct tar_buf records = { NULL, 0, 0 };
+	struct tar_buf path = { NULL, 0, 0 };
+	unsigned long long size = tar_number(header + TAR_SIZE, 12);
+	const struct labelset *sets[3];
+	const struct spec_rule *rule;
+	enum state states[4];
+	const char *key, *value;
+	size_t key_len, value_len;
+	char xattr_key[64];
+	size_t off, len;
+	int attr;
+	int i;
+
+	/* the path is the one of the pax header, or the GNU long name, or
+	 * the prefix and the name of the header */
+	for (off = 0; off < pax_len; off += len) {
+		len = tar_record(pax + off, pax_len - off, &key, &key_len,
+				 &value, &value_len);
+		if (len == 0)
+			tar_fail("invalid extended header");
+		if (key_len == 4 && !memcmp(key, "path", 4)) {
+			path.len = 0;
+			tar_append(&path, value, value_len);
+		} else if (key_len == 4 && !memcmp(key, "size", 4)) {
+			size = strtoull(value, NULL, 10);
+		}
+	}
+	if (path.len == 0 && longname != NULL) {
+		tar_append(&path, longname, strlen(longname));
+	} else if (path.len == 0) {
+		if (!memcmp(header + TAR_MAGIC, "ustar", 6) &&
+		    header[TAR_PREFIX]) {
+			tar_append(&path, header + TAR_PREFIX,
+				   strnlen(header + TAR_PREFIX, 155));
+			tar_append(&path, "/", 1);
+		}
+		tar_append(&path, header + TAR_NAME,
+			   strnlen(header + TAR_NAME, 100));
 	}
 
-	rc = smack_new_label_from_path(path, XATTR_NAME_SMACKMMAP, follow_flag,
-				       &label);
-	if (rc > 0) {
-		printf(" mmap=\"%s\"", label);
-		free(label);
-		has_some_smack = 1;
+	/* directories are archived with a trailing slash */
+	tar_append(&path, "", 1);
+	len = strlen(path.data);
+	while (len > 1 && path.data[len - 1] == '/')
+		path.data[--len] = '\0';
+
+	rule = spec_rules_cnt ? spec_match(path.data) : NULL;
+	sets[0] = rule ? &rule->access : &access_set;
+	sets[1] = rule ? &rule->exec : &exec_set;
+	sets[2] = rule ? &rule->mmap : &mmap_set;
+	for (i = 0; i < 3; i++)
+		states[i] = sets[i]->isset;
+	states[3] = rule ? rule->transmute : transmute_flag;
+	if (states[3] == positive && header[TAR_TYPE] != '5')
+		states[3] = unset;
+
+	/* keep the records but those of the attributes changed */
+	for (off = 0; off < pax_len; off += len) {
+		len = tar_record(pax + off, pax_len - off, &key, &key_len,
+				 &value, &value_len);
+		attr = tar_attr(key, key_len);
+		if (attr < 0 || states[attr] == unset)
+			tar_append(&records, pax + off, len);
+	}
+	for (i = 0; i < 4; i++) {
+		if (states[i] != positive)
+			continue;
+		value = i < 3 ? sets[i]->value : "TRUE";
+		key_len = snprintf(xattr_key, sizeof(xattr_key),
+				   "SCHILY.xattr.%s", tar_attrs[i]);
+		tar_add_record(&records, xattr_key, key_len, value,
+			       strlen(value));
 	}
 
-	rc = smack_new_label_from_path(path, XATTR_NAME_SMACKTRANSMUTE,
-				       follow_flag, &label);
-	if (rc > 0) {
-		printf(" transmute=\"%s\"", label);
-		free(label);
-		has_some_smack = 1;
+	if (records.len)
+		tar_write_pax(path.data, &records);
+	free(records.data);
+	free(path.data);
+
+	/* links, devices and directories have no data */
+	if (header[TAR_TYPE] >= '1' && header[TAR_TYPE] <= '6')
+		return 0;
+	return size;
+}
+
+/* label the entries of the tar stream of the standard input, written to
+ * the standard output */
+static void tar_filter(void)
+{
+	struct tar_buf meta = { NULL, 0, 0 };
+	char header[TAR_BLOCK];
+	char *longname = NULL;
+	char *pax = NULL;
+	size_t pax_len = 0;
+	unsigned long long size;
+	char *data;
+	size_t len;
+	int i;
+
+	while (tar_read(header, TAR_BLOCK)) {
+		for (i = 0; i < TAR_BLOCK && !header[i]; i++)
+			;
+		if (i == TAR_BLOCK) {
+			/* end of archive, copy it and what follows */
+			tar_write(header, TAR_BLOCK);
+			tar_copy((unsigned long long)-1);
+			break;
+		}
+		if (!tar_check(header))
+			tar_fail("invalid header");
+		/* the sparse map may continue in blocks that the size does
+		 * not count, the entry can't be copied blindly */
+		if (header[TAR_TYPE] == 'S')
+			tar_fail("GNU sparse files are not supported, "
+				 "archive them with --format=pax");
+
+		switch (header[TAR_TYPE]) {
+		case 'x':
+			/* replaced by the one written with the entry */
+			free(pax);
+			pax = tar_data(header, &pax_len);
+			continue;
+		case 'L':
+		case 'K':
+			/* GNU long names, written after the pax header */
+			data = tar_data(header, &len);
+			tar_append(&meta, header, TAR_BLOCK);
+			tar_append(&meta, data, tar_padded(len));
+			if (header[TAR_TYPE] == 'L') {
+				free(longname);
+				longname = data;
+			} else {
+				free(data);
+			}
+			continue;
+		case 'g':
+			tar_write(header, TAR_BLOCK);
+			tar_copy(tar_padded(tar_number(header + TAR_SIZE, 12)));
+			continue;
+		}
+
+		size = tar_label(header, pax, pax_len, longname);
+		tar_write(meta.data, meta.len);
+		tar_write(header, TAR_BLOCK);
+		tar_copy(tar_padded(size));
+
+		meta.len = 0;
+		free(longname);
+		longname = NULL;
+		free(pax);
+		pax = NULL;
+		pax_len = 0;
 	}
 
-	printf(has_some_smack ? "\n" : ": No smack property found\n");
+	free(meta.data);
+	free(longname);
+	free(pax);
 }
 
-static void explore(const char *path, void (*fun)(const char*), int follow)
+/* open the directory name in dirfd, known as path, for scanning. Files
+ * that are not directories and directories already scanned, as when a
+ * symbolic link makes a cycle, are silently skipped. */
+static DIR *open_dir(int dirfd, const char *name, const char *path,
+		     int follow)
 {
 	struct stat st;
-	int rc;
-	char *buf;
-	size_t buf_size, dir_name_len, file_name_len;
 	DIR *dir;
-	struct dirent *dent;
+	int fd;
 
-	/* type of the path */
-	rc = (follow ? stat : lstat)(path ? path : ".", &st);
-	if (rc < 0) {
-		perror(path);
-		return;
+	fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC |
+		    (follow ? 0 : O_NOFOLLOW));
+	if (fd < 0) {
+		if (errno != ENOTDIR && (follow || errno != ELOOP))
+			report(path);
+		return NULL;
 	}
 
-	/* no a directory, skip */
-	if (!S_ISDIR(st.st_mode))
-		return;
+	if (fstat(fd, &st) == 0 && !visit(st.st_dev, st.st_ino)) {
+		close(fd);
+		return NULL;
+	}
 
-	/* open the directory */
-	dir = opendir(path ? path : ".");
+	dir = fdopendir(fd);
 	if (dir == NULL) {
-		perror(path);
+		report(path);
+		close(fd);
+	}
+	return dir;
+}
+
+/* whether the directory entry may be a directory to descend */
+static inline int maybe_dir(struct dirent *dent, int follow)
+{
+	return dent->d_type == DT_DIR || dent->d_type == DT_UNKNOWN ||
+	       (follow && dent->d_type == DT_LNK);
+}
+
+/* make room in the path buffer for at least size characters */
+static void path_reserve(struct path_buf *pb, size_t size)
+{
+	char *tmp;
+
+	if (size <= pb->size)
+		return;
+	pb->size = size + 256;
+	tmp = realloc(pb->buf, pb->size);
+	if (tmp == NULL)
+		out_of_memory();
+	pb->buf = tmp;
+}
+
+/* set the path buffer to the prefix of the entries of directory path */
+static size_t path_dir(struct path_buf *pb, const char *path)
+{
+	size_t len = path ? strlen(path) : 1;
+
+	path_reserve(pb, len + 1);
+	memcpy(pb->buf, path ? path : ".", len);
+	while (path && len && pb->buf[len - 1] == '/')
+		len--;
+	return len;
+}
+
+/* append '/' and name to the directory in the first len characters */
+static size_t path_append(struct path_buf *pb, size_t len, const char *name)
+{
+	size_t name_len = strlen(name);
+
+	path_reserve(pb, len + 1 + name_len + 1);
+	pb->buf[len] = '/';
+	memcpy(pb->buf + len + 1, name, name_len + 1);
+	return len + 1 + name_len;
+}
+
+/* apply fun to the entries of the directory name in parent_fd whose path is
+ * in the first len characters of pb, and below them if recursive */
+static void explore(int parent_fd, const char *name, struct path_buf *pb,
+		    size_t len, file_fun fun, int follow)
+{
+	struct dirent *dent;
+	size_t file_len;
+	DIR *dir;
+
+	pb->buf[len] = '\0';
+	dir = open_dir(parent_fd, name, len ? pb->buf : "/", follow);
+	if (dir == NULL)
 		return;
+
+	for (;;) {
+		errno = 0;
+		dent = readdir(dir);
+		if (dent == NULL) {
+			if (errno) {
+				pb->buf[len] = '\0';
+				emit(stderr,
+				     "error: while scaning directory '%s'.\n",
+				     len ? pb->buf : "/");
+			}
+			if (batch != NULL)
+				smack_label_batch_flush(batch);
+			closedir(dir);
+			return;
+		}
+		if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+			continue;
+
+		file_len = path_append(pb, len, dent->d_name);
+		fun(dirfd(dir), dent->d_name, pb->buf, dent->d_type);
+		if (recursive_flag && maybe_dir(dent, follow) &&
+		    (fun != spec_file || spec_descend(pb->buf)))
+			explore(dirfd(dir), dent->d_name, pb, file_len, fun,
+				follow);
 	}
+}
+
+/* release a reference to a scanned directory */
+static void walk_dir_put(struct walk_dir *dir)
+{
+	if (dir && !__atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL)) {
+		closedir(dir->dir);
+		free(dir);
+	}
+}
 
-	/* iterate ove the directory's entries */
-	dir_name_len = path ? strlen(path) : 1;
+/* queue a directory for scanning */
+static void walk_push(struct walk *walk, struct walk_queue *queue,
+		      struct walk_task *task)
+{
+	struct walk_task *tasks;
 
-	/* dir_name_len + sizeof('/') + sizeof(dirent.d_name) + sizeof('\0') */
-	buf_size = dir_name_len + 1 + 256 + 1;
-	buf = malloc(buf_size);
-	if (buf == NULL) {
-		fprintf(stderr, "error: out of memory.\n");
-		exit(1);
+	pthread_mutex_lock(&queue->lock);
+	if (queue->tail == queue->alloc) {
+		if (queue->head > queue->alloc / 2) {
+			memmove(queue->tasks, queue->tasks + queue->head,
+				(queue->tail - queue->head) *
+				sizeof(struct walk_task));
+			queue->tail -= queue->head;
+			queue->head = 0;
+		} else {
+			queue->alloc = queue->alloc ? queue->alloc * 2 : 64;
+			tasks = realloc(queue->tasks, queue->alloc *
+					sizeof(struct walk_task));
+			if (tasks == NULL)
+				out_of_memory();
+			queue->tasks = tasks;
+		}
 	}
+	queue->tasks[queue->tail++] = *task;
+	__atomic_add_fetch(&walk->pending, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&queue->lock);
+}
 
-	if (path) {
-		memcpy(buf, path, dir_name_len);
-		while (dir_name_len && buf[dir_name_len - 1] == '/')
-			dir_name_len--;
-		buf[dir_name_len] = '/';
-	} else {
-		buf[0] = '.';
-		buf[1] = '/';
+/* take a directory, the last one queued by the worker itself, else the
+ * first one queued by another worker */
+static int walk_pop(struct walk *walk, int self, struct walk_task *task)
+{
+	struct walk_queue *queue;
+	int found = 0;
+	int i;
+
+	for (i = 0; i < walk->cnt && !found; i++) {
+		queue = &walk->queues[(self + i) % walk->cnt];
+		pthread_mutex_lock(&queue->lock);
+		if (queue->head < queue->tail) {
+			*task = i ? queue->tasks[queue->head++] :
+				    queue->tasks[--queue->tail];
+			found = 1;
+		}
+		pthread_mutex_unlock(&queue->lock);
 	}
 
+	return found;
+}
+
+/* apply the function to the entries of a directory, queue subdirectories */
+static void walk_scan(struct walk *walk, int self, struct walk_task *task,
+		      struct path_buf *pb)
+{
+	struct walk_task child;
+	struct output_item *item;
+	struct walk_dir *dir;
+	struct dirent *dent;
+	size_t len;
+	DIR *d;
+
+	output_current = task->output;
+
+	d = open_dir(task->parent ? task->parent->dir_fd : AT_FDCWD,
+		     task->name, task->path ? task->path : ".",
+		     walk->follow);
+	walk_dir_put(task->parent);
+	if (d == NULL)
+		return;
+
+	dir = malloc(sizeof(struct walk_dir));
+	if (dir == NULL)
+		out_of_memory();
+	dir->dir = d;
+	dir->dir_fd = dirfd(d);
+	dir->refs = 1;
+
+	len = path_dir(pb, task->path);
 	for (;;) {
 		errno = 0;
-		dent = readdir(dir);
+		dent = readdir(d);
 		if (dent == NULL) {
 			if (errno)
-				fprintf(stderr,
-					"error: while scaning directory '%s'.\n",
-					path ? path : ".");
-			free(buf);
-			closedir(dir);
-			return;
+				emit(stderr,
+				     "error: while scaning directory '%s'.\n",
+				     task->path ? task->path : ".");
+			break;
 		}
 		if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
 			continue;
 
-		file_name_len = strlen(dent->d_name);
-		if (dir_name_len + 1 + file_name_len + 1 > buf_size) {
-			char *tmp;
+		path_append(pb, len, dent->d_name);
+		walk->fun(dir->dir_fd, dent->d_name, pb->buf,
+			  dent->d_type);
+		if (!recursive_flag || !maybe_dir(dent, walk->follow) ||
+		    (walk->fun == spec_file && !spec_descend(pb->buf)))
+			continue;
 
-			buf_size = dir_name_len + 1 + file_name_len + 1;
-			tmp = realloc(buf, buf_size);
-			if (tmp == NULL) {
-				fprintf(stderr, "error: out of memory.\n");
-				exit(1);
-			}
-			buf = tmp;
+		child.path = strdup(pb->buf);
+		if (child.path == NULL)
+			out_of_memory();
+		child.name = child.path + len + 1;
+		child.parent = dir;
+		child.output = NULL;
+		__atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+		if (task->output) {
+			child.output = output_new();
+			item = output_add(task->output);
+			item->child = child.output;
+		}
+		walk_push(walk, &walk->queues[self], &child);
+	}
+
+	walk_dir_put(dir);
+}
+
+struct walk_worker {
+	struct walk *walk;
+	int self;
+};
+
+static void *walk_run(void *arg)
+{
+	struct walk_worker *worker = arg;
+	struct walk *walk = worker->walk;
+	struct path_buf pb = { NULL, 0 };
+	struct walk_task task = { NULL, NULL, NULL, NULL };
+
+	for (;;) {
+		if (walk_pop(walk, worker->self, &task)) {
+			walk_scan(walk, worker->self, &task, &pb);
+			free(task.path);
+			__atomic_sub_fetch(&walk->pending, 1, __ATOMIC_RELEASE);
+		} else if (__atomic_load_n(&walk->pending, __ATOMIC_ACQUIRE)) {
+			sched_yield();
+		} else {
+			break;
+		}
+	}
+
+	output_current = NULL;
+	free(pb.buf);
+	return NULL;
+}
+
+/* apply the function to the paths and, with -r, to the files below them,
+ * or to the files of the current directory if no path is given, using
+ * 'jobs' threads */
+static void walk_parallel(int argc, char *argv[], file_fun fun)
+{
+	struct walk_worker *workers;
+	struct output *root = NULL;
+	struct output_item *item;
+	struct walk_task task = { NULL, NULL, NULL, NULL };
+	pthread_t *threads;
+	struct walk walk;
+	int i;
+
+	memset(&walk, 0, sizeof(walk));
+	walk.cnt = jobs;
+	walk.follow = argc > 0;
+	walk.fun = fun;
+	walk.queues = calloc(jobs, sizeof(struct walk_queue));
+	workers = calloc(jobs, sizeof(struct walk_worker));
+	threads = calloc(jobs, sizeof(pthread_t));
+	if (walk.queues == NULL || workers == NULL || threads == NULL)
+		out_of_memory();
+	for (i = 0; i < jobs; i++) {
+		pthread_mutex_init(&walk.queues[i].lock, NULL);
+		workers[i].walk = &walk;
+		workers[i].self = i;
+	}
+
+	if (ordered_flag)
+		root = output_new();
+	output_current = root;
+
+	if (argc == 0) {
+		task.name = ".";
+		task.output = root;
+		walk_push(&walk, &walk.queues[0], &task);
+	}
+
+	for (i = 0; i < argc; i++) {
+		fun(AT_FDCWD, argv[i], argv[i], DT_UNKNOWN);
+		if (!recursive_flag)
+			continue;
+
+		task.path = strdup(argv[i]);
+		if (task.path == NULL)
+			out_of_memory();
+		task.name = task.path;
+		if (root) {
+			task.output = output_new();
+			item = output_add(root);
+			item->child = task.output;
+		}
+		walk_push(&walk, &walk.queues[0], &task);
+	}
+
+	for (i = 1; i < jobs; i++)
+		if (pthread_create(&threads[i], NULL, walk_run, &workers[i])) {
+			fprintf(stderr, "error: can't start threads.\n");
+			exit(1);
 		}
+	walk_run(&workers[0]);
+	for (i = 1; i < jobs; i++)
+		pthread_join(threads[i], NULL);
 
-		memcpy(buf + dir_name_len + 1, dent->d_name, file_name_len + 1);
-		fun(buf);
-		if (recursive_flag)
-			explore(buf, fun, follow);
+	if (root)
+		output_flush(root);
+
+	for (i = 0; i < jobs; i++) {
+		pthread_mutex_destroy(&walk.queues[i].lock);
+		free(walk.queues[i].tasks);
 	}
+	free(walk.queues);
+	free(workers);
+	free(threads);
 }
 
 /* set the state to to */
@@ -319,7 +2102,11 @@ int main(int argc, char *argv[])
 {
 	struct labelset *labelset;
 
-	void (*fun)(const char*);
+	struct path_buf pb = { NULL, 0 };
+	const char *spec = NULL;
+	const char *manifest = NULL;
+	const char *dump = NULL;
+	file_fun fun;
 	enum state delete_flag = unset;
 	enum state svalue;
 	int modify = 0;
@@ -371,6 +2158,36 @@ int main(int argc, char *argv[])
 		case 'r':
 			set_state(&recursive_flag, positive, c, 0);
 			break;
+		case 'u':
+			set_state(&update_flag, positive, c, 0);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs <= 0) {
+				fprintf(stderr, "jobs: invalid number '%s'.\n",
+					optarg);
+				exit(1);
+			}
+			break;
+		case 'o':
+			set_state(&ordered_flag, positive, c, 0);
+			break;
+		case 'S':
+			spec = optarg;
+			break;
+		case 'F':
+			manifest = optarg;
+			break;
+		case 'O':
+			dump = optarg;
+			break;
+		case 'I':
+			manifest = optarg;
+			set_state(&restore_flag, positive, c, 0);
+			break;
+		case 'X':
+			set_state(&tar_flag, positive, c, 0);
+			break;
 		case 'v':
 			printf("%s (libsmack) version " PACKAGE_VERSION "\n",
 			       basename(argv[0]));
@@ -458,15 +2275,71 @@ int main(int argc, char *argv[])
 	}
 
 	/* process */
+	if (tar_flag) {
+		if (manifest || dump || optind != argc ||
+		    (spec && modify) || (!spec && !modify)) {
+			fprintf(stderr, "tar: requires either attribute "
+				"options or a spec, and no paths.\n");
+			exit(1);
+		}
+		if (spec)
+			spec_load(spec);
+		tar_filter();
+		exit(0);
+	}
+
+	if (!jobs && !dump && (modify || spec || manifest) &&
+	    smack_label_batch_new(&batch, LABEL_BATCH_DEPTH, 0))
+		batch = NULL;
+
+	if (manifest) {
+		if (modify || spec || dump || optind != argc) {
+			fprintf(stderr, "%s: can't be used with paths or "
+				"attribute options.\n",
+				restore_flag ? "restore" : "from-manifest");
+			exit(1);
+		}
+		manifest_apply(manifest);
+		smack_label_batch_free(batch);
+		exit(failures ? 1 : 0);
+	}
+
 	fun = modify ? modify_file : print_file;
-	if (optind == argc) {
-		explore(NULL, fun, 0);
+	if (dump) {
+		/* attribute options select the files to dump */
+		if (spec) {
+			fprintf(stderr, "dump: can't be used with spec.\n");
+			exit(1);
+		}
+		recursive_flag = positive;
+		fun = dump_file;
+	} else if (spec) {
+		if (modify) {
+			fprintf(stderr, "spec: can't be used with other "
+				"attribute options.\n");
+			exit(1);
+		}
+		spec_load(spec);
+		update_flag = positive;
+		fun = spec_file;
+	}
+	if (jobs) {
+		walk_parallel(argc - optind, argv + optind, fun);
+	} else if (optind == argc) {
+		explore(AT_FDCWD, ".", &pb, path_dir(&pb, NULL), fun, 0);
 	} else {
 		for (i = optind; i < argc; i++) {
-			fun(argv[i]);
+			fun(AT_FDCWD, argv[i], argv[i], DT_UNKNOWN);
 			if (recursive_flag)
-				explore(argv[i], fun, 1);
+				explore(AT_FDCWD, argv[i], &pb,
+					path_dir(&pb, argv[i]), fun, 1);
 		}
 	}
+	smack_label_batch_free(batch);
+	free(pb.buf);
+	if (dump) {
+		dump_write(dump);
+		exit(failures ? 1 : 0);
+	}
 	exit(0);
 }
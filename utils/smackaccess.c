@@ -28,28 +28,109 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <getopt.h>
+#include "common.h"
 #include "config.h"
 
 static const char usage[] =
 	"Usage: %s [options] <subject> <object> <access>\n"
+	"       %s [options] --batch [file]\n"
 	"options:\n"
 	" -v --version       output version information and exit\n"
 	" -h --help          output usage information and exit\n"
+	" -b --batch         check '<subject> <object> <access>' lines read\n"
+	"                    from file or stdin, one result per line\n"
+	" -p --policy <path> answer from the rules in path (a file or a\n"
+	"                    directory) instead of the kernel policy\n"
 ;
 
-static const char short_options[] = "vh";
+static const char short_options[] = "vhbp:";
 
 static struct option options[] = {
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
+	{"batch", no_argument, 0, 'b'},
+	{"policy", required_argument, 0, 'p'},
 	{NULL, 0, 0, 0}
 };
 
+static struct smack_policy *policy = NULL;
+
+static int check_access(const char *subject, const char *object,
+			const char *access)
+{
+	if (policy)
+		return smack_policy_have_access(policy, subject, object,
+						access);
+	return smack_have_access(subject, object, access);
+}
+
+static struct smack_policy *load_policy(const char *path)
+{
+	struct smack_accesses *rules = NULL;
+	struct smack_policy *result = NULL;
+
+	if (smack_accesses_new(&rules)) {
+		fputs("Out of memory.\n", stderr);
+		return NULL;
+	}
+
+	if (load_rules(path, rules) == 0 && smack_policy_new(&result, rules))
+		fputs("Out of memory.\n", stderr);
+
+	smack_accesses_free(rules);
+	return result;
+}
+
+static int check_batch(FILE *file, const char *name)
+{
+	char *buf = NULL;
+	size_t buf_len = 0;
+	const char *subject, *object, *access;
+	char *ptr;
+	unsigned int line = 0;
+	int ret = 0;
+	int res;
+
+	while (getline(&buf, &buf_len, file) >= 0) {
+		++line;
+		subject = strtok_r(buf, " \t\n", &ptr);
+		if (subject == NULL)
+			continue;
+		object = strtok_r(NULL, " \t\n", &ptr);
+		access = strtok_r(NULL, " \t\n", &ptr);
+
+		if (object == NULL || access == NULL ||
+		    strtok_r(NULL, " \t\n", &ptr) != NULL)
+			res = -1;
+		else
+			res = check_access(subject, object, access);
+
+		if (res < 0) {
+			fprintf(stderr, "%s: line %u: input values are invalid.\n",
+				name, line);
+			res = -1;
+			ret = -1;
+		}
+		printf("%d\n", res);
+	}
+
+	if (ferror(file)) {
+		fprintf(stderr, "%s: reading input failed.\n", name);
+		ret = -1;
+	}
+
+	free(buf);
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	const char *subject;
 	const char *object;
 	const char *access;
+	const char *policy_path = NULL;
+	int batch = 0;
+	FILE *file;
 	int ret;
 	int c;
 
@@ -65,24 +146,56 @@ int main(int argc, char **argv)
 			       basename(argv[0]));
 			exit(0);
 		case 'h':
-			printf(usage, basename(argv[0]));
+			printf(usage, basename(argv[0]), basename(argv[0]));
 			exit(0);
+		case 'b':
+			batch = 1;
+			break;
+		case 'p':
+			policy_path = optarg;
+			break;
 		default:
-			printf(usage, basename(argv[0]));
+			printf(usage, basename(argv[0]), basename(argv[0]));
 			exit(1);
 		}
 	}
 
-	if ((argc - optind) != 3) {
-		printf(usage, basename(argv[0]));
+	if (batch ? (argc - optind) > 1 : (argc - optind) != 3) {
+		printf(usage, basename(argv[0]), basename(argv[0]));
 		exit(1);
 	}
 
+	if (policy_path) {
+		policy = load_policy(policy_path);
+		if (policy == NULL)
+			return EXIT_FAILURE;
+	}
+
+	if (batch) {
+		if (optind == argc || !strcmp(argv[optind], "-")) {
+			file = stdin;
+		} else {
+			file = fopen(argv[optind], "r");
+			if (file == NULL) {
+				perror(argv[optind]);
+				smack_policy_free(policy);
+				return EXIT_FAILURE;
+			}
+		}
+
+		ret = check_batch(file, basename(argv[0]));
+		if (file != stdin)
+			fclose(file);
+		smack_policy_free(policy);
+		return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	subject = argv[optind];
 	object = argv[optind + 1];
 	access = argv[optind + 2];
 
-	ret = smack_have_access(subject, object, access);
+	ret = check_access(subject, object, access);
+	smack_policy_free(policy);
 	if (ret < 0) {
 		fprintf(stderr,"%s: input values are invalid.\n", basename(argv[0]));
 		return EXIT_FAILURE;
@@ -91,4 +204,3 @@ int main(int argc, char **argv)
 	printf("%d\n", ret);
 	return EXIT_SUCCESS;
 }
-
@@ -32,6 +32,7 @@ static const char usage[] =
 	"options:\n"
 	" -v --version       output version information and exit\n"
 	" -h --help          output usage information and exit\n"
+	" -s --stats         print the counts of changed and unchanged mappings\n"
 	"path - path from which files will be loaded and parsed,\n"
 	"if this is a directory all files from this directory will be loaded\n"
 	"files should have a format of each line: 'label level [list of categories]'\n"
@@ -41,16 +42,20 @@ static const char usage[] =
 	"path may be omitted, if it is, then cipso are loaded from stdin\n"
 ;
 
-static const char short_options[] = "vh";
+static const char short_options[] = "vhs";
 
 static struct option options[] = {
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
+	{"stats", no_argument, 0, 's'},
 	{NULL, 0, 0, 0}
 };
 
 int main(int argc, char **argv)
 {
+	int changed = 0;
+	int unchanged = 0;
+	int stats = 0;
 	int c;
 
 	for ( ; ; ) {
@@ -67,6 +72,9 @@ int main(int argc, char **argv)
 		case 'h':
 			printf(usage, basename(argv[0]));
 			exit(0);
+		case 's':
+			stats = 1;
+			break;
 		default:
 			printf(usage, basename(argv[0]));
 			exit(1);
@@ -83,13 +91,13 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (argc == 1) {
-		if (apply_cipso(NULL))
-			exit(1);
-	} else {
-		if (apply_cipso(argv[1]))
-			exit(1);
-	}
+	if (apply_cipso(optind < argc ? argv[optind] : NULL, &changed,
+			&unchanged))
+		exit(1);
+
+	if (stats)
+		printf("%d mappings changed, %d unchanged.\n", changed,
+		       unchanged);
 
 	exit(0);
 }
@@ -0,0 +1,254 @@
+/*
+ * This file is part of libsmack
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <sys/smack.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <search.h>
+#include "config.h"
+
+#define COMM_LEN 16
+
+static const char usage[] =
+	"Usage: %s [options]\n"
+	"options:\n"
+	" -v --version       output version information and exit\n"
+	" -h --help          output usage information and exit\n"
+	" -c --count         print the number of processes per label\n"
+	" -j --jobs <n>      read the process labels with n threads\n"
+;
+
+static const char short_options[] = "vhcj:";
+
+static struct option options[] = {
+	{"version", no_argument, 0, 'v'},
+	{"help", no_argument, 0, 'h'},
+	{"count", no_argument, 0, 'c'},
+	{"jobs", required_argument, 0, 'j'},
+	{NULL, 0, 0, 0}
+};
+
+struct label_count {
+	unsigned long count;
+	char label[SMACK_LABEL_LEN + 1];
+};
+
+static int proc_fd = -1;
+static void *counts = NULL;
+static size_t counts_len = 0;
+static int out_of_memory = 0;
+static struct label_count **count_list = NULL;
+static size_t count_list_len = 0;
+static pthread_mutex_t counts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void read_comm(pid_t pid, char *comm)
+{
+	char path[32];
+	int fd;
+	int ret;
+
+	snprintf(path, sizeof(path), "%d/comm", pid);
+	fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		strcpy(comm, "?");
+		return;
+	}
+
+	ret = read(fd, comm, COMM_LEN);
+	close(fd);
+	if (ret <= 0) {
+		strcpy(comm, "?");
+		return;
+	}
+
+	if (comm[ret - 1] == '\n')
+		ret--;
+	comm[ret] = '\0';
+}
+
+static int print_process(pid_t pid, const char *label, void *data)
+{
+	char comm[COMM_LEN + 1];
+
+	(void)data;
+	read_comm(pid, comm);
+	printf("%7d %-16s %s\n", pid, comm, label);
+	return 0;
+}
+
+static int compare_labels(const void *a, const void *b)
+{
+	return strcmp(((const struct label_count *)a)->label,
+		      ((const struct label_count *)b)->label);
+}
+
+static int count_process(pid_t pid, const char *label, void *data)
+{
+	struct label_count key;
+	struct label_count *entry;
+	struct label_count **found;
+	int ret = 0;
+
+	(void)pid;
+	(void)data;
+
+	/* Only the first process of a label allocates, the others just
+	 * bump the count of its entry. */
+	strcpy(key.label, label);
+
+	pthread_mutex_lock(&counts_lock);
+	found = tfind(&key, &counts, compare_labels);
+	if (found != NULL) {
+		(*found)->count++;
+		goto out;
+	}
+
+	entry = malloc(sizeof(struct label_count));
+	if (entry == NULL)
+		goto err_out;
+	entry->count = 1;
+	strcpy(entry->label, label);
+
+	found = tsearch(entry, &counts, compare_labels);
+	if (found == NULL) {
+		free(entry);
+		goto err_out;
+	}
+	counts_len++;
+	goto out;
+
+err_out:
+	out_of_memory = 1;
+	ret = -1;
+out:
+	pthread_mutex_unlock(&counts_lock);
+	return ret;
+}
+
+static void collect_count(const void *node, VISIT which, int depth)
+{
+	(void)depth;
+	if (which != postorder && which != leaf)
+		return;
+
+	count_list[count_list_len++] = *(struct label_count * const *)node;
+}
+
+static int compare_counts(const void *a, const void *b)
+{
+	const struct label_count *x = *(struct label_count * const *)a;
+	const struct label_count *y = *(struct label_count * const *)b;
+
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+	return strcmp(x->label, y->label);
+}
+
+int main(int argc, char **argv)
+{
+	int count = 0;
+	int jobs = 1;
+	size_t i;
+	int ret;
+	int c;
+
+	for ( ; ; ) {
+		c = getopt_long(argc, argv, short_options, options, NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'v':
+			printf("%s (libsmack) version " PACKAGE_VERSION "\n",
+			       basename(argv[0]));
+			exit(0);
+		case 'h':
+			printf(usage, basename(argv[0]));
+			exit(0);
+		case 'c':
+			count = 1;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1) {
+				fprintf(stderr, "%s: invalid number of jobs '%s'.\n",
+					basename(argv[0]), optarg);
+				exit(1);
+			}
+			break;
+		default:
+			printf(usage, basename(argv[0]));
+			exit(1);
+		}
+	}
+
+	if (optind != argc) {
+		printf(usage, basename(argv[0]));
+		exit(1);
+	}
+
+	proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (proc_fd < 0) {
+		perror("/proc");
+		return EXIT_FAILURE;
+	}
+
+	if (!count)
+		printf("%7s %-16s %s\n", "PID", "COMMAND", "LABEL");
+
+	ret = smack_foreach_process_label(NULL, jobs,
+					  count ? count_process : print_process,
+					  NULL);
+	if (ret < 0) {
+		fprintf(stderr, "%s: reading process labels failed.\n",
+			basename(argv[0]));
+		return EXIT_FAILURE;
+	}
+
+	if (count) {
+		count_list = calloc(counts_len ? counts_len : 1,
+				    sizeof(*count_list));
+		if (count_list == NULL)
+			out_of_memory = 1;
+	}
+
+	if (out_of_memory) {
+		fputs("Out of memory.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (count) {
+		twalk(counts, collect_count);
+		qsort(count_list, count_list_len, sizeof(*count_list),
+		      compare_counts);
+		for (i = 0; i < count_list_len; i++)
+			printf("%7lu %s\n", count_list[i]->count,
+			       count_list[i]->label);
+	}
+
+	close(proc_fd);
+	return EXIT_SUCCESS;
+}